@@ -0,0 +1,312 @@
+#include "dir_cache.h"
+#include "file_manager.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Cached listings are packed in display order as a 16-bit firmware index, a
+// flag byte, a length byte and the NUL-terminated name. Restored entries point
+// straight at these names, so a slot must not be freed while it is on screen.
+#define DIR_CACHE_RECORD_HEADER 4
+
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+typedef struct
+{
+    uint32_t key;
+    uint32_t lastUsed;
+    uint32_t size;
+    uint16_t count;
+    uint16_t generation; // Firmware generation the listing was taken at
+    uint8_t* data;
+} dirCacheSlot;
+
+static dirCacheSlot cacheSlots[DIR_CACHE_SLOTS];
+static uint32_t cacheClock;
+static uint32_t cacheUsed;
+
+static dirLevel levels[DIR_CACHE_MAX_DEPTH];
+static uint8_t depth;
+
+// Names of the levels below the root joined with '/'. Each level only looks
+// at the first pathLength bytes, so leaving a level needs no bookkeeping.
+static char path[DIR_CACHE_PATH_SIZE];
+
+static void dir_cache_free_slot(dirCacheSlot* slot)
+{
+    if (slot->data)
+    {
+        free(slot->data);
+        cacheUsed -= slot->size;
+    }
+    slot->data = NULL;
+    slot->size = 0;
+    slot->count = 0;
+}
+
+static dirCacheSlot* dir_cache_find(uint32_t key)
+{
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        if (cacheSlots[i].data && cacheSlots[i].key == key)
+        {
+            return &cacheSlots[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Returns a free slot, evicting the least recently used listings until both a
+// slot and enough of the byte budget are available.
+static dirCacheSlot* dir_cache_make_room(uint32_t size)
+{
+    for (;;)
+    {
+        dirCacheSlot* freeSlot = NULL;
+        dirCacheSlot* oldest = NULL;
+
+        for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+        {
+            dirCacheSlot* slot = &cacheSlots[i];
+            if (!slot->data)
+            {
+                freeSlot = slot;
+            }
+            else if (!oldest || slot->lastUsed < oldest->lastUsed)
+            {
+                oldest = slot;
+            }
+        }
+
+        if (freeSlot && (cacheUsed + size) <= DIR_CACHE_BUDGET)
+        {
+            return freeSlot;
+        }
+        if (!oldest)
+        {
+            return NULL;
+        }
+        dir_cache_free_slot(oldest);
+    }
+}
+
+void dir_cache_clear(void)
+{
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        dir_cache_free_slot(&cacheSlots[i]);
+    }
+}
+
+// The new copy is built before any previous one for the same key is dropped,
+// so a listing that was restored from that slot can be stored back into it.
+// Its entries still point at the old copy and have to be restored again.
+void dir_cache_store(uint32_t key, uint16_t count, uint16_t generation)
+{
+    uint32_t size = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        size += DIR_CACHE_RECORD_HEADER + file_manager_get_file_data(i)->length + 1;
+    }
+
+    // An empty folder still gets a (1-byte) allocation so it counts as cached.
+    uint8_t* data = size <= DIR_CACHE_BUDGET ? (uint8_t*)malloc(size ? size : 1) : NULL;
+    if (data)
+    {
+        uint8_t* ptr = data;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            const fileData* file = file_manager_get_file_data(i);
+            uint16_t id = file_manager_get_file_index(i);
+            uint8_t length = file->length;
+
+            ptr[0] = id & 0xFF;
+            ptr[1] = id >> 8;
+            ptr[2] = file->flag;
+            ptr[3] = length;
+            memcpy(&ptr[DIR_CACHE_RECORD_HEADER], file->filename, length + 1);
+            ptr += DIR_CACHE_RECORD_HEADER + length + 1;
+        }
+    }
+
+    dirCacheSlot* slot = dir_cache_find(key);
+    if (slot)
+    {
+        dir_cache_free_slot(slot);
+    }
+    if (!data)
+    {
+        return;
+    }
+
+    slot = dir_cache_make_room(size);
+    if (!slot)
+    {
+        free(data);
+        return;
+    }
+
+    slot->data = data;
+    slot->key = key;
+    slot->size = size;
+    slot->count = count;
+    slot->generation = generation;
+    slot->lastUsed = ++cacheClock;
+    cacheUsed += size;
+}
+
+bool dir_cache_restore(uint32_t key, uint16_t* count, uint16_t* generation)
+{
+    dirCacheSlot* slot = dir_cache_find(key);
+    if (!slot)
+    {
+        return false;
+    }
+
+    file_manager_clear();
+
+    const uint8_t* ptr = slot->data;
+    for (uint16_t i = 0; i < slot->count; i++)
+    {
+        uint16_t id = ptr[0] | (ptr[1] << 8);
+        uint8_t length = ptr[3];
+
+        file_manager_ref_file_data(i, id, ptr[2], (const char*)&ptr[DIR_CACHE_RECORD_HEADER], length);
+        ptr += DIR_CACHE_RECORD_HEADER + length + 1;
+    }
+
+    slot->lastUsed = ++cacheClock;
+    *count = slot->count;
+    *generation = slot->generation;
+    return true;
+}
+
+// Drops every cached listing except the one for `key`.
+void dir_cache_retain(uint32_t key)
+{
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        if (cacheSlots[i].key != key)
+        {
+            dir_cache_free_slot(&cacheSlots[i]);
+        }
+    }
+}
+
+void dir_cache_reset_path(void)
+{
+    depth = 0;
+    levels[0].key = FNV_OFFSET_BASIS;
+    levels[0].id = 0;
+    levels[0].selectedIndex = 0;
+    levels[0].pathLength = 0;
+}
+
+static uint32_t dir_cache_child_key(uint32_t key, const char* name)
+{
+    key = (key ^ '/') * FNV_PRIME;
+    for (; *name; name++)
+    {
+        key = (key ^ (uint8_t)*name) * FNV_PRIME;
+    }
+
+    return key;
+}
+
+bool dir_cache_has_child(const char* name)
+{
+    return dir_cache_find(dir_cache_child_key(levels[depth].key, name)) != NULL;
+}
+
+void dir_cache_enter(uint16_t id, const char* name, uint16_t selectedIndex)
+{
+    levels[depth].selectedIndex = selectedIndex;
+
+    // Past the maximum depth the deepest level is reused, so going back up
+    // from there loses the cursor position but keeps working.
+    uint32_t key = dir_cache_child_key(levels[depth].key, name);
+    uint32_t pathLength = DIR_CACHE_PATH_SIZE;
+    if (depth < DIR_CACHE_MAX_DEPTH - 1)
+    {
+        uint32_t parentLength = levels[depth].pathLength;
+        uint32_t nameLength = strlen(name);
+
+        // The separator (none under the root) and the name; the NUL is put
+        // in by dir_cache_get_path().
+        uint32_t length = parentLength + (parentLength ? 1 : 0) + nameLength;
+        if (parentLength < DIR_CACHE_PATH_SIZE && length < DIR_CACHE_PATH_SIZE)
+        {
+            if (parentLength)
+            {
+                path[parentLength] = '/';
+            }
+            memcpy(&path[length - nameLength], name, nameLength);
+            pathLength = length;
+        }
+        depth++;
+    }
+
+    levels[depth].key = key;
+    levels[depth].id = id;
+    levels[depth].selectedIndex = 0;
+    levels[depth].pathLength = pathLength;
+}
+
+void dir_cache_enter_path(const char* newPath)
+{
+    char name[DIR_CACHE_PATH_SIZE];
+
+    dir_cache_reset_path();
+    while (*newPath)
+    {
+        const char* end = strchr(newPath, '/');
+        uint32_t length = end ? (uint32_t)(end - newPath) : strlen(newPath);
+
+        if (length > 0 && length < sizeof(name))
+        {
+            memcpy(name, newPath, length);
+            name[length] = 0;
+            dir_cache_enter(DIR_CACHE_ID_UNKNOWN, name, 0);
+        }
+
+        newPath += length;
+        if (*newPath == '/')
+        {
+            newPath++;
+        }
+    }
+}
+
+bool dir_cache_leave(dirLevel* child, uint16_t* selectedIndex)
+{
+    if (depth == 0)
+    {
+        return false;
+    }
+
+    *child = levels[depth--];
+    *selectedIndex = levels[depth].selectedIndex;
+    return true;
+}
+
+uint8_t dir_cache_get_depth(void)
+{
+    return depth;
+}
+
+const dirLevel* dir_cache_get_level(void)
+{
+    return &levels[depth];
+}
+
+const char* dir_cache_get_path(void)
+{
+    if (levels[depth].pathLength >= DIR_CACHE_PATH_SIZE)
+    {
+        return NULL;
+    }
+
+    path[levels[depth].pathLength] = 0;
+    return path;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "file_manager.h"
+
+// Sorted listings of recently visited directories are kept in RAM so moving
+// back and forth between folders doesn't have to go through the firmware
+// again. Directories are identified by a hash of their path from the root.
+#define DIR_CACHE_SLOTS 16
+
+// Enough for a listing whose names fill the whole name store, with each
+// entry's 5 bytes of header and terminator on top. Listings bigger than this
+// are not cached and go through the firmware every time.
+#define DIR_CACHE_BUDGET (FILE_NAME_CHUNK_SIZE * FILE_NAME_CHUNKS + MAX_FILE_ITEMS * 5)
+#define DIR_CACHE_MAX_DEPTH 32
+#define DIR_CACHE_PATH_SIZE 1024
+
+// Levels reached through dir_cache_enter_path() were never listed by the menu,
+// so their firmware index isn't known.
+#define DIR_CACHE_ID_UNKNOWN 0xFFFF
+
+// One entry per level of the navigation stack, root first.
+typedef struct
+{
+	uint32_t key;
+	uint16_t id;            // Firmware index this directory was entered with
+	uint16_t selectedIndex; // Cursor position when a child was entered
+	uint16_t pathLength;    // Length of the path to it, DIR_CACHE_PATH_SIZE if it didn't fit
+} dirLevel;
+
+void dir_cache_clear(void);
+void dir_cache_store(uint32_t key, uint16_t count, uint16_t generation);
+bool dir_cache_restore(uint32_t key, uint16_t* count, uint16_t* generation);
+void dir_cache_retain(uint32_t key);
+bool dir_cache_has_child(const char* name);
+
+void dir_cache_reset_path(void);
+void dir_cache_enter(uint16_t id, const char* name, uint16_t selectedIndex);
+
+/// @brief Replace the navigation stack with the levels of a '/'-separated
+/// path from the root, as sent with IO_COMMAND_GOTO_PATH.
+void dir_cache_enter_path(const char* path);
+bool dir_cache_leave(dirLevel* child, uint16_t* selectedIndex);
+uint8_t dir_cache_get_depth(void);
+const dirLevel* dir_cache_get_level(void);
+
+/// @brief Path of the current directory from the root ("" for the root), or
+/// NULL if it is too long or deeper than DIR_CACHE_MAX_DEPTH.
+const char* dir_cache_get_path(void);
@@ -0,0 +1,74 @@
+#include "display_list.h"
+
+// Where the frame carries on once the segment being built is done, NULL when
+// packets go straight into the frame, and the frame's limit.
+static uint32_t *resumePacket = NULL;
+static uint32_t *resumeLimit;
+
+void display_list_reserve(DMAChain *chain, displaySegment *segment, uint16_t words)
+{
+	chain->limit -= words;
+	segment->key = 0;
+	segment->data = chain->limit;
+	segment->last = NULL;
+	segment->words = words;
+}
+
+// FNV-1a over the string, starting from the seed.
+uint32_t display_list_key(uint32_t seed, const char *str)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	for (; *str; str++)
+	{
+		hash = (hash ^ (uint8_t)*str) * 16777619u;
+	}
+	return hash;
+}
+
+bool display_list_begin(DMAChain *chain, displaySegment *segment, uint32_t key, uint16_t words)
+{
+	// 0 marks an empty segment.
+	key = key ? key : 1;
+	if (segment->key == key)
+	{
+		return false;
+	}
+
+	// The closing packet, and the word allocatePacket() keeps clear.
+	if (words + 2 > segment->words)
+	{
+		segment->key = 0;
+		return true;
+	}
+
+	resumePacket = chain->nextPacket;
+	resumeLimit = chain->limit;
+	chain->nextPacket = segment->data;
+	chain->limit = segment->data + segment->words;
+	segment->key = key;
+	return true;
+}
+
+void display_list_end(DMAChain *chain, displaySegment *segment)
+{
+	if (segment->key == 0)
+	{
+		// Drawn straight into the frame.
+		return;
+	}
+
+	if (resumePacket)
+	{
+		// Close it with an empty packet, whose tag is rewritten on every link.
+		segment->last = allocatePacket(chain, 0) - 1;
+		chain->nextPacket = resumePacket;
+		chain->limit = resumeLimit;
+		resumePacket = NULL;
+	}
+
+	// An empty packet in the frame jumps to the segment, and the segment's
+	// closing one jumps back to whatever comes next.
+	uint32_t *link = allocatePacket(chain, 0) - 1;
+	*link = gp0_tag(0, segment->data);
+	*segment->last = gp0_tag(0, chain->nextPacket);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpu.h"
+
+// Packets built once and linked into a frame's chain until what they draw
+// changes. A segment keeps its packets at the end of the DMAChain buffer it
+// is linked into, above the chain's limit so frames can't grow into it, and
+// is only rewritten while building that chain's next frame, never while the
+// GPU may still be reading it.
+typedef struct
+{
+	uint32_t key;   // What was drawn into it, 0 if nothing is
+	uint32_t *data; // Its packets, first one first
+	uint32_t *last; // Tag of the packet closing it, pointed at the rest of the frame
+	uint16_t words;
+} displaySegment;
+
+/// @brief Set `segment` up to keep its packets in the last `words` words
+/// below `chain`'s limit, and lower the limit past them.
+void display_list_reserve(DMAChain *chain, displaySegment *segment, uint16_t words);
+
+/// @brief Key for drawing `str` on top of `seed` (position, colour, ...):
+/// segments are only rebuilt when it changes.
+uint32_t display_list_key(uint32_t seed, const char *str);
+
+/// @brief Start drawing `segment` into `chain`. Returns false if it already
+/// holds what `key` stands for, and the caller can skip drawing. Otherwise
+/// the caller draws with allocatePacket() as usual, at most `words` words,
+/// into the segment, or into the frame if they don't fit.
+bool display_list_begin(DMAChain *chain, displaySegment *segment, uint32_t key, uint16_t words);
+
+/// @brief Finish what display_list_begin() started and link the segment into
+/// the frame at this point.
+void display_list_end(DMAChain *chain, displaySegment *segment);
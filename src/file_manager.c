@@ -3,8 +3,48 @@
 #include <string.h>
 #include <stdio.h>
 
-uint16_t* fileIndexBuffer;
+uint16_t* fileIndexBuffer; // The order entries are shown in, one of fileOrders
+uint16_t* fileOrders[FILE_SORT_MODES];
+uint8_t fileOrdersValid; // Bit per mode whose order matches the listing
+fileSortMode fileSortModeShown;
 fileData* fileDataBuffer;
+char* fileNameChunks[FILE_NAME_CHUNKS];
+uint8_t fileNameChunk;      // Chunk new names go to
+uint16_t fileNameChunkUsed; // Bytes of it taken
+uint16_t fileDataUsed; // Slots written since the last clear, sorted or not
+uint32_t* sortKeys;        // Per position in fileIndexBuffer
+uint32_t* sortScratchKeys;
+uint16_t* sortScratch;
+char* fileShadowChunks[FILE_SHADOW_CHUNKS]; // Same scheme as the name chunks
+uint8_t fileShadowChunk;
+uint16_t fileShadowChunkUsed;
+const char** fileShadows; // Per slot, NULL if it has none
+uint8_t* fileShadowLengths;
+uint32_t* fileShadowMasks;
+bool fileWindowed; // Window slots are rewritten in any order and get no shadow
+
+// Goes back to showing the listing in name order, which everything that adds,
+// removes or sorts entries works on, and forgets the other orders.
+static void file_manager_drop_orders(void)
+{
+	fileIndexBuffer = fileOrders[FILE_SORT_NAME];
+	fileSortModeShown = FILE_SORT_NAME;
+	fileOrdersValid = 1 << FILE_SORT_NAME;
+}
+
+// strcmp() on bytes as unsigned, the order the radix sort's keys give. The
+// console's strcmp() compares them as (signed) chars, so names with bytes
+// past 0x7F would sort one way or the other depending on which path got to
+// them.
+static int file_manager_strcmp(const char* a, const char* b)
+{
+    while (*a && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
 
 int file_manager_compare(uint16_t indexA, uint16_t indexB) 
 {
@@ -15,93 +55,936 @@ int file_manager_compare(uint16_t indexA, uint16_t indexB)
     if ((a->flag == 0) && (b->flag == 1)) return 1;  // Files after directories
 
     // Both same type, compare names
-    return strcmp(a->filename, b->filename);
+    return file_manager_strcmp(a->filename, b->filename);
 }
 
-void file_manager_quicksort(uint16_t left, uint16_t right) 
+// Runs of entries still to be sorted, all of whose names share their first
+// `depth` bytes. Only runs longer than SORT_INSERTION_MAX are pushed, and they
+// never overlap, so the stack can't hold more than this.
+#define SORT_INSERTION_MAX 32
+#define SORT_STACK_SIZE (MAX_FILE_ITEMS / (SORT_INSERTION_MAX + 1) + 2)
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t count;
+    uint16_t depth;
+} sortRun;
+
+static sortRun sortStack[SORT_STACK_SIZE];
+
+// Sorted runs waiting for file_manager_merge_runs(): run i ends where
+// sortRunEnds[i] says, and starts where the one before it ended.
+static uint16_t sortRunEnds[FILE_SORT_RUNS];
+static uint8_t sortRuns;
+
+// Bytes [depth, depth + 4) of the name, big endian, zero past its end.
+static uint32_t file_manager_sort_key(const fileData* file, uint16_t depth)
 {
-    if (left >= right)
+    const uint8_t* name = (const uint8_t*)file->filename + depth;
+    uint32_t key = 0;
+    for (int i = 0; i < 4; i++)
     {
-        return;
+        key <<= 8;
+        if (*name)
+        {
+            key |= *name++;
+        }
     }
+    return key;
+}
 
-    int pivotIndex = fileIndexBuffer[(left + right) / 2];
+// Fills in sortKeys for entries [start, start + count) and returns the bits
+// that differ between any of them and the first.
+static uint32_t file_manager_load_keys(uint16_t start, uint16_t count, uint16_t depth)
+{
+    uint32_t first = file_manager_sort_key(&fileDataBuffer[fileIndexBuffer[start]], depth);
+    uint32_t differing = 0;
+    for (uint16_t i = start; i < start + count; i++)
+    {
+        sortKeys[i] = file_manager_sort_key(&fileDataBuffer[fileIndexBuffer[i]], depth);
+        differing |= sortKeys[i] ^ first;
+    }
+    return differing;
+}
 
-    int i = left;
-    int j = right;
+// Insertion sort of entries [start, start + count) on their sortKeys, then
+// on the rest of their names for keys that tie.
+static void file_manager_insertion_sort(uint16_t start, uint16_t count, uint16_t depth)
+{
+    uint32_t* keys = &sortKeys[start];
+    uint16_t* entries = &fileIndexBuffer[start];
 
-    while (i <= j) {
-        while (file_manager_compare(fileIndexBuffer[i], pivotIndex) < 0) i++;
-        while (file_manager_compare(fileIndexBuffer[j], pivotIndex) > 0) j--;
-        if (i <= j) {
-            uint16_t temp = fileIndexBuffer[i];
-            fileIndexBuffer[i] = fileIndexBuffer[j];
-            fileIndexBuffer[j] = temp;
-            i++;
+    for (uint16_t i = 1; i < count; i++)
+    {
+        uint32_t key = keys[i];
+        uint16_t entry = entries[i];
+        const char* rest = fileDataBuffer[entry].filename + depth;
+        uint16_t j = i;
+        while (j > 0 && (keys[j - 1] > key ||
+            (keys[j - 1] == key && (key & 0xFF) && file_manager_strcmp(fileDataBuffer[entries[j - 1]].filename + depth, rest) > 0)))
+        {
+            keys[j] = keys[j - 1];
+            entries[j] = entries[j - 1];
             j--;
         }
+        keys[j] = key;
+        entries[j] = entry;
+    }
+}
+
+// LSD radix sort of entries [start, start + count) on their sortKeys, a byte
+// per pass. Only bytes set in `differing` (keys XORed with the first one and
+// ORed together) get a pass.
+static void file_manager_radix_sort(uint16_t start, uint16_t count, uint32_t differing)
+{
+    uint32_t* keys = &sortKeys[start];
+    uint16_t* entries = &fileIndexBuffer[start];
+    uint32_t* keysTo = sortScratchKeys;
+    uint16_t* entriesTo = sortScratch;
+
+    for (uint8_t shift = 0; shift < 32; shift += 8)
+    {
+        if (!((differing >> shift) & 0xFF))
+        {
+            continue;
+        }
+
+        uint16_t buckets[256] = {0};
+        for (uint16_t i = 0; i < count; i++)
+        {
+            buckets[(keys[i] >> shift) & 0xFF]++;
+        }
+
+        uint16_t offset = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            uint16_t size = buckets[b];
+            buckets[b] = offset;
+            offset += size;
+        }
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint16_t position = buckets[(keys[i] >> shift) & 0xFF]++;
+            keysTo[position] = keys[i];
+            entriesTo[position] = entries[i];
+        }
+
+        uint32_t* swapKeys = keys;
+        keys = keysTo;
+        keysTo = swapKeys;
+        uint16_t* swapEntries = entries;
+        entries = entriesTo;
+        entriesTo = swapEntries;
     }
 
-    if (left < j) file_manager_quicksort(left, j);
-    if (i < right) file_manager_quicksort(i, right);
+    if (keys != &sortKeys[start])
+    {
+        memcpy(&sortKeys[start], keys, sizeof(uint32_t) * count);
+        memcpy(&fileIndexBuffer[start], entries, sizeof(uint16_t) * count);
+    }
 }
 
+// Open-addressed table of the .cue files in the listing, keyed by name
+// without the extension. Holds fileDataBuffer index + 1, zero when free, and
+// is never more than half full.
+#define CUE_TABLE_SIZE (MAX_FILE_ITEMS * 2)
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+static uint16_t cueTable[CUE_TABLE_SIZE];
+
+static uint32_t file_manager_hash_stem(const char* name, uint16_t length)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static bool file_manager_has_extension(const fileData* file, const char* extension)
+{
+    return file->flag != 1 && file->length > 4 && strcmp(file->filename + file->length - 4, extension) == 0;
+}
+
+// Length of "Game" in "Game (Track 01)" or "Game Track 2", 0 for names that
+// aren't one track of a multi-track set.
+static uint16_t file_manager_track_stem(const char* name, uint16_t length)
+{
+    bool bracketed = length > 0 && name[length - 1] == ')';
+    uint16_t end = bracketed ? length - 1 : length;
+    uint16_t digits = end;
+    while (digits > 0 && name[digits - 1] >= '0' && name[digits - 1] <= '9')
+    {
+        digits--;
+    }
+    if (digits == end || end - digits > 2)
+    {
+        return 0;
+    }
+
+    const char* prefix = bracketed ? " (Track " : " Track ";
+    uint16_t prefixLength = strlen(prefix);
+    if (digits <= prefixLength || memcmp(name + digits - prefixLength, prefix, prefixLength) != 0)
+    {
+        return 0;
+    }
+    return digits - prefixLength;
+}
+
+static bool file_manager_has_cue(const char* stem, uint16_t length, uint16_t mask)
+{
+    for (uint32_t slot = file_manager_hash_stem(stem, length) & mask; cueTable[slot]; slot = (slot + 1) & mask)
+    {
+        const fileData* cue = &fileDataBuffer[cueTable[slot] - 1];
+        if (cue->length - 4 == length && memcmp(cue->filename, stem, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops every .bin that has a .cue of the same name, or for "Game (Track 01).bin"
+// style tracks, a "Game.cue". Only the .cue is left to launch the game from.
 void file_manager_clean_list(uint16_t* count)
 {
-    int i = 0;
-    while (i < *count - 1)
+    file_manager_drop_orders();
+
+    uint16_t mask = 1;
+    while (mask < *count * 2 && mask < CUE_TABLE_SIZE)
+    {
+        mask <<= 1;
+    }
+    memset(cueTable, 0, sizeof(uint16_t) * mask);
+    mask--;
+
+    bool anyCue = false;
+    for (uint16_t i = 0; i < *count; i++)
     {
-        int binIndex = fileIndexBuffer[i];
-        const char* binName = fileDataBuffer[binIndex].filename;
-        size_t len = strlen(binName);
+        const fileData* file = &fileDataBuffer[fileIndexBuffer[i]];
+        if (!file_manager_has_extension(file, ".cue"))
+        {
+            continue;
+        }
 
-        if (len >= 4 && strcmp(binName + len - 4, ".bin") == 0)
+        uint32_t slot = file_manager_hash_stem(file->filename, file->length - 4) & mask;
+        while (cueTable[slot])
         {
-            int cueIndex = fileIndexBuffer[i + 1];
-            const char* cueName = fileDataBuffer[cueIndex].filename;
-            if (strlen(cueName) == len &&
-                strncmp(binName, cueName, len - 4) == 0 &&
-                strcmp(cueName + len - 4, ".cue") == 0)
+            slot = (slot + 1) & mask;
+        }
+        cueTable[slot] = fileIndexBuffer[i] + 1;
+        anyCue = true;
+    }
+    if (!anyCue)
+    {
+        return;
+    }
+
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < *count; i++)
+    {
+        const fileData* file = &fileDataBuffer[fileIndexBuffer[i]];
+        if (file_manager_has_extension(file, ".bin"))
+        {
+            uint16_t stem = file->length - 4;
+            uint16_t trackStem = file_manager_track_stem(file->filename, stem);
+            if (file_manager_has_cue(file->filename, stem, mask) ||
+                (trackStem && file_manager_has_cue(file->filename, trackStem, mask)))
             {
-                for (int j = i; j < *count - 1; ++j)
-                {
-                    fileIndexBuffer[j] = fileIndexBuffer[j + 1];
-                }
-                (*count)--;
                 continue;
             }
         }
-        i++;
+        fileIndexBuffer[kept++] = fileIndexBuffer[i];
     }
+    *count = kept;
 }
 
 void file_manager_init()
 {
-	fileIndexBuffer = (uint16_t*)malloc(sizeof(uint16_t) * MAX_FILE_ITEMS);
+	for (uint8_t i = 0; i < FILE_SORT_MODES; i++)
+	{
+		fileOrders[i] = (uint16_t*)malloc(sizeof(uint16_t) * MAX_FILE_ITEMS);
+	}
+	fileIndexBuffer = fileOrders[FILE_SORT_NAME];
+	fileSortModeShown = FILE_SORT_NAME;
+	fileOrdersValid = 1 << FILE_SORT_NAME;
 	fileDataBuffer = (fileData*)malloc(sizeof(fileData) * MAX_FILE_ITEMS);
+	sortKeys = (uint32_t*)malloc(sizeof(uint32_t) * MAX_FILE_ITEMS);
+	sortScratchKeys = (uint32_t*)malloc(sizeof(uint32_t) * MAX_FILE_ITEMS);
+	sortScratch = (uint16_t*)malloc(sizeof(uint16_t) * MAX_FILE_ITEMS);
+	fileShadows = (const char**)malloc(sizeof(const char*) * MAX_FILE_ITEMS);
+	fileShadowLengths = (uint8_t*)malloc(MAX_FILE_ITEMS);
+	fileShadowMasks = (uint32_t*)malloc(sizeof(uint32_t) * MAX_FILE_ITEMS);
+	fileNameChunks[0] = (char*)malloc(FILE_NAME_CHUNK_SIZE);
+	fileNameChunk = 0;
+	fileNameChunkUsed = 0;
+	fileShadowChunks[0] = (char*)malloc(FILE_NAME_CHUNK_SIZE);
+	fileShadowChunk = 0;
+	fileShadowChunkUsed = 0;
+}
+
+// Forgets every copied name. Entries referencing them must be replaced before
+// they are read again.
+void file_manager_clear()
+{
+	for (uint8_t i = 1; i < FILE_NAME_CHUNKS; i++)
+	{
+		free(fileNameChunks[i]);
+		fileNameChunks[i] = NULL;
+	}
+	for (uint8_t i = 1; i < FILE_SHADOW_CHUNKS; i++)
+	{
+		free(fileShadowChunks[i]);
+		fileShadowChunks[i] = NULL;
+	}
+	fileNameChunk = 0;
+	fileNameChunkUsed = 0;
+	fileShadowChunk = 0;
+	fileShadowChunkUsed = 0;
+	fileDataUsed = 0;
+	fileWindowed = false;
+	sortRuns = 0;
+	file_manager_drop_orders();
+}
+
+static char* file_manager_get_chunk_of(char** chunks, uint8_t chunk)
+{
+	if (!chunks[chunk])
+	{
+		chunks[chunk] = (char*)malloc(FILE_NAME_CHUNK_SIZE);
+	}
+	return chunks[chunk];
+}
+
+static char* file_manager_get_chunk(uint8_t chunk)
+{
+	return file_manager_get_chunk_of(fileNameChunks, chunk);
 }
 
-void file_manager_init_file_data(uint16_t index, uint8_t flag, char* filename, uint16_t filename_length)
+// Takes `size` bytes from `chunks`, of which `numChunks` may be allocated.
+static char* file_manager_alloc_in(char** chunks, uint8_t numChunks, uint8_t* chunk, uint16_t* used, uint16_t size)
 {
-	fileData* file = &fileDataBuffer[index];
+	// A name never straddles two chunks; the end of a full one is left unused.
+	if (*used + size > FILE_NAME_CHUNK_SIZE)
+	{
+		if (*chunk + 1 >= numChunks || !file_manager_get_chunk_of(chunks, *chunk + 1))
+		{
+			return NULL;
+		}
+		(*chunk)++;
+		*used = 0;
+	}
+
+	char* name = &chunks[*chunk][*used];
+	*used += size;
+	return name;
+}
+
+static const char* file_manager_store_name(const char* filename, uint16_t filename_length)
+{
+	char* name = file_manager_alloc_in(fileNameChunks, FILE_NAME_CHUNKS, &fileNameChunk, &fileNameChunkUsed, filename_length + 1);
+	if (name)
+	{
+		memcpy(name, filename, filename_length);
+		name[filename_length] = 0;
+	}
+	return name;
+}
+
+// Folds `name` for filtering into `out`, which needs `length` bytes, and
+// returns how many it took.
+uint16_t file_manager_fold_name(char* out, const char* name, uint16_t length)
+{
+	uint16_t folded = 0;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		char c = name[i];
+		if (c >= 'A' && c <= 'Z')
+		{
+			out[folded++] = c - 'A' + 'a';
+		}
+		else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+		{
+			out[folded++] = c;
+		}
+	}
+	return folded;
+}
+
+// A bit for each character in a folded name: a-z, then the digits sharing
+// the last six. A name can only contain text whose bits it has all of.
+uint32_t file_manager_fold_mask(const char* folded, uint16_t length)
+{
+	uint32_t mask = 0;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		char c = folded[i];
+		mask |= 1u << (c >= 'a' ? c - 'a' : 26 + (c - '0') % 6);
+	}
+	return mask;
+}
+
+// Folds the name into the shadow chunks, then gives back what folding left
+// unused.
+static void file_manager_set_shadow(uint16_t slot, const char* filename, uint16_t filename_length)
+{
+	char* shadow = fileWindowed ? NULL
+		: file_manager_alloc_in(fileShadowChunks, FILE_SHADOW_CHUNKS, &fileShadowChunk, &fileShadowChunkUsed, filename_length);
+	fileShadows[slot] = shadow;
+	if (!shadow)
+	{
+		return;
+	}
+
+	uint8_t length = file_manager_fold_name(shadow, filename, filename_length);
+	fileShadowChunkUsed -= filename_length - length;
+	fileShadowLengths[slot] = length;
+	fileShadowMasks[slot] = file_manager_fold_mask(shadow, length);
+}
+
+static void file_manager_set_slot(uint16_t slot, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length)
+{
+	file_manager_set_shadow(slot, filename, filename_length);
+
+	fileData* file = &fileDataBuffer[slot];
 	file->flag = flag;
-	memcpy(file->filename, filename, filename_length);
-	file->filename[filename_length] = 0;
+	file->length = filename_length;
+	file->id = id;
+	file->filename = filename;
+	if (slot >= fileDataUsed)
+	{
+		fileDataUsed = slot + 1;
+	}
+}
+
+// Copies the name into the name store. Returns false once the store is full.
+bool file_manager_init_file_data(uint16_t index, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length)
+{
+	const char* name = file_manager_store_name(filename, filename_length);
+	if (!name)
+	{
+		return false;
+	}
+
+	file_manager_ref_file_data(index, id, flag, name, filename_length);
+	return true;
+}
+
+// Points the entry at a name that is already NUL-terminated and outlives it.
+void file_manager_ref_file_data(uint16_t index, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length)
+{
+	file_manager_set_slot(index, id, flag, filename, filename_length);
 	fileIndexBuffer[index] = index;
 }
 
+#define FILE_WINDOW_SLOTS_PER_CHUNK (FILE_NAME_CHUNK_SIZE / (MAX_FILE_LENGTH + 1))
+
+#if FILE_WINDOW_ENTRIES > FILE_WINDOW_SLOTS_PER_CHUNK * FILE_NAME_CHUNKS
+#error "Window entries don't fit in the name chunks"
+#endif
+
+// Drops the listing and sets every name chunk the window needs aside. Returns
+// false, leaving the listing alone, if the heap can't spare them.
+bool file_manager_start_window()
+{
+    for (uint8_t i = 0; i < (FILE_WINDOW_ENTRIES + FILE_WINDOW_SLOTS_PER_CHUNK - 1) / FILE_WINDOW_SLOTS_PER_CHUNK; i++)
+    {
+        if (!file_manager_get_chunk(i))
+        {
+            return false;
+        }
+    }
+
+    fileNameChunk = 0;
+    fileNameChunkUsed = 0;
+    fileDataUsed = 0;
+    fileWindowed = true;
+    file_manager_drop_orders();
+    return true;
+}
+
+// Replaces window slot `slot`, copying the name into the slot's own part of
+// the name chunks, so slots can be reused in any order. Not to be mixed with
+// the other ways of adding entries until file_manager_clear().
+void file_manager_set_window_entry(uint16_t slot, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length)
+{
+    char* name = &fileNameChunks[slot / FILE_WINDOW_SLOTS_PER_CHUNK][(slot % FILE_WINDOW_SLOTS_PER_CHUNK) * (MAX_FILE_LENGTH + 1)];
+    memcpy(name, filename, filename_length);
+    name[filename_length] = 0;
+
+    file_manager_ref_file_data(slot, id, flag, name, filename_length);
+}
+
+// Adds an entry to an already sorted list at the position the sort would have
+// put it, in a fresh slot. Returns false if there is no room left.
+bool file_manager_insert_sorted(uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length, uint16_t* count)
+{
+    if (*count >= MAX_FILE_ITEMS || fileDataUsed >= MAX_FILE_ITEMS)
+    {
+        return false;
+    }
+
+    const char* name = file_manager_store_name(filename, filename_length);
+    if (!name)
+    {
+        return false;
+    }
+
+    uint16_t slot = fileDataUsed;
+    file_manager_set_slot(slot, id, flag, name, filename_length);
+    file_manager_drop_orders();
+
+    uint16_t low = 0;
+    uint16_t high = *count;
+    while (low < high)
+    {
+        uint16_t mid = (low + high) / 2;
+        if (file_manager_compare(fileIndexBuffer[mid], slot) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    memmove(&fileIndexBuffer[low + 1], &fileIndexBuffer[low], sizeof(uint16_t) * (*count - low));
+    fileIndexBuffer[low] = slot;
+    (*count)++;
+    return true;
+}
+
+// Drops the entry with firmware index `id` from the list. Its slot is not
+// reused until the next clear.
+void file_manager_remove_id(uint16_t id, uint16_t* count)
+{
+    file_manager_drop_orders();
+    for (uint16_t i = 0; i < *count; i++)
+    {
+        if (fileDataBuffer[fileIndexBuffer[i]].id == id)
+        {
+            memmove(&fileIndexBuffer[i], &fileIndexBuffer[i + 1], sizeof(uint16_t) * (*count - i - 1));
+            (*count)--;
+            return;
+        }
+    }
+}
+
 fileData* file_manager_get_file_data(uint16_t index)
 {
 	uint16_t fileIndex = fileIndexBuffer[index];
 	return &fileDataBuffer[fileIndex];
 }
 
+// Folded name of the entry shown at `index` (not NUL-terminated) and its
+// file_manager_fold_mask(), NULL if it didn't get one.
+const char* file_manager_get_shadow(uint16_t index, uint8_t* length, uint32_t* mask)
+{
+	uint16_t slot = fileIndexBuffer[index];
+	*length = fileShadowLengths[slot];
+	*mask = fileShadowMasks[slot];
+	return fileShadows[slot];
+}
+
+// Firmware index of the entry shown at `index`, as the navigation and mount
+// commands expect it.
 uint16_t file_manager_get_file_index(uint16_t index)
 {
-	return fileIndexBuffer[index];
+	return fileDataBuffer[fileIndexBuffer[index]].id;
+}
+
+uint16_t file_manager_find_index(uint16_t id, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (fileDataBuffer[fileIndexBuffer[i]].id == id)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+uint16_t file_manager_find_name(const char* name, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (strcmp(fileDataBuffer[fileIndexBuffer[i]].filename, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+// Sorts entries [start, start + count): directories first, then MSD radix
+// sort on four bytes of the names at a time. Each run of entries that tie on
+// them is sorted again on the next four, without recursing. Short runs are
+// finished by insertion sort.
+static void file_manager_sort_range(uint16_t start, uint16_t count)
+{
+	uint16_t end = start + count;
+	uint16_t dirs = start;
+	for (uint16_t i = start; i < end; i++)
+	{
+		if (fileDataBuffer[fileIndexBuffer[i]].flag == 1)
+		{
+			sortScratch[dirs++] = fileIndexBuffer[i];
+		}
+	}
+	uint16_t files = dirs;
+	for (uint16_t i = start; i < end; i++)
+	{
+		if (fileDataBuffer[fileIndexBuffer[i]].flag != 1)
+		{
+			sortScratch[files++] = fileIndexBuffer[i];
+		}
+	}
+	memcpy(&fileIndexBuffer[start], &sortScratch[start], sizeof(uint16_t) * count);
+
+	uint16_t top = 0;
+	sortStack[top++] = (sortRun){dirs, (uint16_t)(end - dirs), 0};
+	sortStack[top++] = (sortRun){start, (uint16_t)(dirs - start), 0};
+	while (top > 0)
+	{
+		sortRun run = sortStack[--top];
+		uint16_t runEnd = run.start + run.count;
+		if (run.count < 2)
+		{
+			continue;
+		}
+
+		uint32_t differing = file_manager_load_keys(run.start, run.count, run.depth);
+		if (run.count <= SORT_INSERTION_MAX)
+		{
+			file_manager_insertion_sort(run.start, run.count, run.depth);
+			continue;
+		}
+
+		// A shared prefix just moves on to the next four bytes. Keys ending
+		// in a zero byte belong to names that ended there, and tie only with
+		// themselves.
+		if (!differing)
+		{
+			if (sortKeys[run.start] & 0xFF)
+			{
+				sortStack[top++] = (sortRun){run.start, run.count, (uint16_t)(run.depth + 4)};
+			}
+			continue;
+		}
+
+		file_manager_radix_sort(run.start, run.count, differing);
+		for (uint16_t i = run.start; i < runEnd;)
+		{
+			uint16_t tieEnd = i + 1;
+			while (tieEnd < runEnd && sortKeys[tieEnd] == sortKeys[i])
+			{
+				tieEnd++;
+			}
+			uint16_t ties = tieEnd - i;
+			if (ties > SORT_INSERTION_MAX && (sortKeys[i] & 0xFF))
+			{
+				sortStack[top++] = (sortRun){i, ties, (uint16_t)(run.depth + 4)};
+			}
+			else if (ties > 1 && (sortKeys[i] & 0xFF))
+			{
+				file_manager_load_keys(i, ties, run.depth + 4);
+				file_manager_insertion_sort(i, ties, run.depth + 4);
+			}
+			i = tieEnd;
+		}
+	}
 }
 
 void file_manager_sort(uint16_t count)
 {
-	file_manager_quicksort(0, count - 1);
+	file_manager_drop_orders();
+
+	// An empty folder (or a search without matches) has nothing to sort.
+	if (count < 2)
+	{
+		return;
+	}
+
+	file_manager_sort_range(0, count);
+}
+
+// Merge state: the next entry of each run, its sort key (directories first,
+// then the first four bytes of the name) and a min-heap of the runs ordered
+// by it.
+static uint16_t mergeHeads[FILE_SORT_RUNS];
+static uint16_t mergeEnds[FILE_SORT_RUNS];
+static uint64_t mergeKeys[FILE_SORT_RUNS];
+static uint8_t mergeHeap[FILE_SORT_RUNS];
+
+static void file_manager_load_head(uint8_t run)
+{
+	const fileData* file = &fileDataBuffer[fileIndexBuffer[mergeHeads[run]]];
+	mergeKeys[run] = ((uint64_t)(file->flag != 1) << 32) | file_manager_sort_key(file, 0);
+}
+
+// The same order as file_manager_sort(), between the heads of two runs.
+static bool file_manager_head_before(uint8_t a, uint8_t b)
+{
+	if (mergeKeys[a] != mergeKeys[b])
+	{
+		return mergeKeys[a] < mergeKeys[b];
+	}
+	return (mergeKeys[a] & 0xFF) &&
+		file_manager_strcmp(fileDataBuffer[fileIndexBuffer[mergeHeads[a]]].filename + 4, fileDataBuffer[fileIndexBuffer[mergeHeads[b]]].filename + 4) < 0;
+}
+
+static void file_manager_sift_down(uint8_t slot, uint8_t size)
+{
+	uint8_t run = mergeHeap[slot];
+	while (slot * 2 + 1 < size)
+	{
+		uint8_t child = slot * 2 + 1;
+		if (child + 1 < size && file_manager_head_before(mergeHeap[child + 1], mergeHeap[child]))
+		{
+			child++;
+		}
+		if (!file_manager_head_before(mergeHeap[child], run))
+		{
+			break;
+		}
+		mergeHeap[slot] = mergeHeap[child];
+		slot = child;
+	}
+	mergeHeap[slot] = run;
+}
+
+// Merges runs [first, sortRuns) into a single run.
+static void file_manager_merge_from(uint8_t first)
+{
+	uint8_t size = sortRuns - first;
+	if (size < 2)
+	{
+		return;
+	}
+
+	uint16_t start = first ? sortRunEnds[first - 1] : 0;
+	uint16_t end = sortRunEnds[sortRuns - 1];
+	for (uint8_t i = 0; i < size; i++)
+	{
+		mergeHeads[i] = i ? sortRunEnds[first + i - 1] : start;
+		mergeEnds[i] = sortRunEnds[first + i];
+		mergeHeap[i] = i;
+		file_manager_load_head(i);
+	}
+	for (int slot = size / 2 - 1; slot >= 0; slot--)
+	{
+		file_manager_sift_down(slot, size);
+	}
+
+	for (uint16_t out = start; out < end; out++)
+	{
+		uint8_t run = mergeHeap[0];
+		sortScratch[out] = fileIndexBuffer[mergeHeads[run]++];
+		if (mergeHeads[run] == mergeEnds[run])
+		{
+			mergeHeap[0] = mergeHeap[--size];
+		}
+		else
+		{
+			file_manager_load_head(run);
+		}
+		file_manager_sift_down(0, size);
+	}
+	memcpy(&fileIndexBuffer[start], &sortScratch[start], sizeof(uint16_t) * (end - start));
+
+	sortRunEnds[first] = end;
+	sortRuns = first + 1;
+}
+
+static uint16_t file_manager_run_size(uint8_t run)
+{
+	return sortRunEnds[run] - (run ? sortRunEnds[run - 1] : 0);
+}
+
+// Sorts the entries added since the last run (or the last clear) as a run of
+// their own, for a listing that arrives a page at a time. Runs are merged as
+// soon as the newest one is as big as the one before, so there are only ever
+// a handful and each entry is merged a few times at most. The rest are put
+// in order by file_manager_merge_runs().
+void file_manager_sort_run(uint16_t count)
+{
+	file_manager_drop_orders();
+
+	uint16_t start = sortRuns ? sortRunEnds[sortRuns - 1] : 0;
+	if (count <= start)
+	{
+		return;
+	}
+
+	if (sortRuns == FILE_SORT_RUNS)
+	{
+		file_manager_merge_from(0);
+	}
+
+	file_manager_sort_range(start, count - start);
+	sortRunEnds[sortRuns++] = count;
+
+	while (sortRuns > 1 && file_manager_run_size(sortRuns - 1) >= file_manager_run_size(sortRuns - 2))
+	{
+		file_manager_merge_from(sortRuns - 2);
+	}
+}
+
+// Finishes a listing sorted with file_manager_sort_run(), leaving the first
+// `count` entries in file_manager_sort() order.
+void file_manager_merge_runs(uint16_t count)
+{
+	file_manager_sort_run(count);
+	file_manager_merge_from(0);
+}
+
+static bool file_manager_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static uint8_t file_manager_lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : (uint8_t)c;
+}
+
+// Like file_manager_strcmp(), but runs of digits compare by their value, so
+// "Disc 2" comes before "Disc 10". Numbers that only differ in leading zeros
+// tie.
+static int file_manager_compare_natural(const char* a, const char* b)
+{
+	while (*a && *b)
+	{
+		if (file_manager_is_digit(*a) && file_manager_is_digit(*b))
+		{
+			while (*a == '0') a++;
+			while (*b == '0') b++;
+
+			uint16_t digitsA = 0;
+			uint16_t digitsB = 0;
+			while (file_manager_is_digit(a[digitsA])) digitsA++;
+			while (file_manager_is_digit(b[digitsB])) digitsB++;
+			if (digitsA != digitsB)
+			{
+				return digitsA < digitsB ? -1 : 1;
+			}
+
+			int result = memcmp(a, b, digitsA);
+			if (result)
+			{
+				return result;
+			}
+			a += digitsA;
+			b += digitsB;
+			continue;
+		}
+
+		if (*a != *b)
+		{
+			return (uint8_t)*a - (uint8_t)*b;
+		}
+		a++;
+		b++;
+	}
+	return (uint8_t)*a - (uint8_t)*b;
+}
+
+// Like file_manager_strcmp(), with upper and lower case letters tying.
+static int file_manager_compare_no_case(const char* a, const char* b)
+{
+	while (*a && file_manager_lower(*a) == file_manager_lower(*b))
+	{
+		a++;
+		b++;
+	}
+	return file_manager_lower(*a) - file_manager_lower(*b);
+}
+
+static int (*const fileSortCompares[FILE_SORT_MODES])(const char*, const char*) = {
+	[FILE_SORT_NAME] = file_manager_strcmp,
+	[FILE_SORT_NATURAL] = file_manager_compare_natural,
+	[FILE_SORT_NO_CASE] = file_manager_compare_no_case,
+};
+
+// Directories first, then `compare` on the names.
+static bool file_manager_sorts_before(uint16_t slotA, uint16_t slotB, int (*compare)(const char*, const char*))
+{
+	const fileData* a = &fileDataBuffer[slotA];
+	const fileData* b = &fileDataBuffer[slotB];
+	if ((a->flag == 1) != (b->flag == 1))
+	{
+		return a->flag == 1;
+	}
+	return compare(a->filename, b->filename) < 0;
+}
+
+// Bottom-up merge sort of `order` by `compare`. It's stable, and the order is
+// started from name order, so names that tie stay in name order.
+static void file_manager_sort_order(uint16_t* order, uint16_t count, int (*compare)(const char*, const char*))
+{
+	uint16_t* from = order;
+	uint16_t* to = sortScratch;
+	for (uint32_t width = 1; width < count; width *= 2)
+	{
+		for (uint32_t start = 0; start < count; start += width * 2)
+		{
+			uint32_t middle = start + width < count ? start + width : count;
+			uint32_t end = middle + width < count ? middle + width : count;
+			uint32_t left = start;
+			uint32_t right = middle;
+			uint32_t out = start;
+			while (left < middle && right < end)
+			{
+				// Right only goes first when strictly smaller, to keep it stable
+				to[out++] = file_manager_sorts_before(from[right], from[left], compare) ? from[right++] : from[left++];
+			}
+			while (left < middle) to[out++] = from[left++];
+			while (right < end) to[out++] = from[right++];
+		}
+
+		uint16_t* swap = from;
+		from = to;
+		to = swap;
+	}
+
+	if (from != order)
+	{
+		memcpy(order, from, sizeof(uint16_t) * count);
+	}
+}
+
+// Shows the first `count` entries in `mode` order from now on. Each order is
+// worked out from name order the first time it's asked for, and kept until
+// the listing changes, so switching back and forth only swaps which order
+// file_manager_get_file_data() reads. Returns false if `mode` was already
+// shown.
+bool file_manager_set_sort_mode(fileSortMode mode, uint16_t count)
+{
+	if (mode == fileSortModeShown || mode >= FILE_SORT_MODES)
+	{
+		return false;
+	}
+
+	if (!(fileOrdersValid & (1 << mode)))
+	{
+		memcpy(fileOrders[mode], fileOrders[FILE_SORT_NAME], sizeof(uint16_t) * count);
+		file_manager_sort_order(fileOrders[mode], count, fileSortCompares[mode]);
+		fileOrdersValid |= 1 << mode;
+	}
+
+	fileIndexBuffer = fileOrders[mode];
+	fileSortModeShown = mode;
+	return true;
+}
+
+fileSortMode file_manager_get_sort_mode(void)
+{
+	return fileSortModeShown;
 }
@@ -2,18 +2,68 @@
 
 #include <stdint.h>
 
+#include <stdbool.h>
+
 #define MAX_FILE_LENGTH 255
 #define MAX_FILE_ITEMS 4096
 
+// Backing for names that can't stay where they were read from (compressed
+// listing pages, pages that didn't fit in the listing sector pool). Names are
+// packed back to back in chunks that are only allocated once the ones before
+// are full, and handed back to the heap (for the directory cache) whenever
+// the listing is cleared. Only the first chunk is kept for good.
+#define FILE_NAME_CHUNK_SIZE (16 * 1024)
+#define FILE_NAME_CHUNKS 16
+
+// Chunks, kept the same way, for each name's shadow: lower-cased, with
+// everything but letters and digits left out, for filtering as the user
+// types. Names past what fits go without one (file_manager_get_shadow()).
+#define FILE_SHADOW_CHUNKS 8
+
+// Entries kept around the cursor in folders too big to hold whole (see
+// listing_getEntry()). Each one owns a fixed MAX_FILE_LENGTH + 1 stretch of
+// the name chunks.
+#define FILE_WINDOW_ENTRIES 1024
+
+// Sorted runs a listing can be split into before they have to be merged.
+#define FILE_SORT_RUNS 64
+
+// Orders a listing can be shown in. Each keeps directories first. Name order
+// (plain byte order) is the one listings are loaded and cached in.
+typedef enum
+{
+	FILE_SORT_NAME,
+	FILE_SORT_NATURAL, // Digit runs by value: "Disc 2" before "Disc 10"
+	FILE_SORT_NO_CASE,
+	FILE_SORT_MODES
+} fileSortMode;
+
 typedef struct
 {
 	uint8_t flag;
-	char filename[MAX_FILE_LENGTH + 1];
+	uint8_t length;
+	uint16_t id; // Index of the entry on the firmware side
+	const char* filename; // NUL-terminated, owned by a listing sector or the name store
 } fileData;
 
 void file_manager_init();
-void file_manager_init_file_data(uint16_t index, uint8_t flag, char* filename, uint16_t filename_length);
+void file_manager_clear();
+bool file_manager_init_file_data(uint16_t index, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length);
+void file_manager_ref_file_data(uint16_t index, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length);
+bool file_manager_start_window(void);
+void file_manager_set_window_entry(uint16_t slot, uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length);
+bool file_manager_insert_sorted(uint16_t id, uint8_t flag, const char* filename, uint16_t filename_length, uint16_t* count);
+void file_manager_remove_id(uint16_t id, uint16_t* count);
 fileData* file_manager_get_file_data(uint16_t index);
+uint16_t file_manager_fold_name(char* out, const char* name, uint16_t length);
+uint32_t file_manager_fold_mask(const char* folded, uint16_t length);
+const char* file_manager_get_shadow(uint16_t index, uint8_t* length, uint32_t* mask);
 uint16_t file_manager_get_file_index(uint16_t index);
+uint16_t file_manager_find_index(uint16_t id, uint16_t count);
+uint16_t file_manager_find_name(const char* name, uint16_t count);
 void file_manager_sort(uint16_t count);
-void file_manager_clean_list(uint16_t* count);
\ No newline at end of file
+void file_manager_sort_run(uint16_t count);
+void file_manager_merge_runs(uint16_t count);
+void file_manager_clean_list(uint16_t* count);
+bool file_manager_set_sort_mode(fileSortMode mode, uint16_t count);
+fileSortMode file_manager_get_sort_mode(void);
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "filter.h"
+
+#include <string.h>
+
+#include "file_manager.h"
+
+// Matches in listing order, and the first place in each shadow the query was
+// found: a longer query can't match any earlier.
+static uint16_t filterMatches[MAX_FILE_ITEMS];
+static uint8_t filterOffsets[MAX_FILE_ITEMS];
+static uint16_t filterCount;
+static uint16_t filterTotal; // Entries the matches were picked from
+static bool filterValid;
+
+static char filterQuery[MAX_FILE_LENGTH];
+static uint16_t filterQueryLength;
+static uint32_t filterQueryMask;
+
+// For names that didn't get a shadow.
+static char filterFolded[MAX_FILE_LENGTH];
+
+void filter_clear(void)
+{
+	filterValid = false;
+	filterCount = 0;
+}
+
+static int16_t findQuery(const char *shadow, uint16_t length, uint16_t from)
+{
+	if (filterQueryLength == 0)
+	{
+		return 0;
+	}
+
+	for (uint16_t position = from; position + filterQueryLength <= length; position++)
+	{
+		if (shadow[position] == filterQuery[0] && memcmp(&shadow[position + 1], &filterQuery[1], filterQueryLength - 1) == 0)
+		{
+			return position;
+		}
+	}
+	return -1;
+}
+
+static bool matchEntry(uint16_t index, uint16_t from, uint16_t row)
+{
+	uint8_t length;
+	uint32_t mask;
+	const char *shadow = file_manager_get_shadow(index, &length, &mask);
+	if (!shadow)
+	{
+		const fileData *file = file_manager_get_file_data(index);
+		length = file_manager_fold_name(filterFolded, file->filename, file->length);
+		mask = file_manager_fold_mask(filterFolded, length);
+		shadow = filterFolded;
+	}
+
+	// Most names are missing one of the characters typed and never get
+	// searched.
+	if ((mask & filterQueryMask) != filterQueryMask)
+	{
+		return false;
+	}
+
+	int16_t position = findQuery(shadow, length, from);
+	if (position < 0)
+	{
+		return false;
+	}
+
+	filterMatches[row] = index;
+	filterOffsets[row] = position;
+	return true;
+}
+
+void filter_set(const char *text, uint16_t count)
+{
+	uint16_t textLength = strlen(text);
+	if (textLength > MAX_FILE_LENGTH)
+	{
+		textLength = MAX_FILE_LENGTH;
+	}
+
+	char query[MAX_FILE_LENGTH];
+	uint16_t queryLength = file_manager_fold_name(query, text, textLength);
+
+	bool refine = filterValid && filterTotal == count && queryLength >= filterQueryLength &&
+		memcmp(query, filterQuery, filterQueryLength) == 0;
+	if (refine && queryLength == filterQueryLength)
+	{
+		return;
+	}
+
+	memcpy(filterQuery, query, queryLength);
+	filterQueryLength = queryLength;
+	filterQueryMask = file_manager_fold_mask(query, queryLength);
+
+	uint16_t kept = 0;
+	if (refine)
+	{
+		for (uint16_t row = 0; row < filterCount; row++)
+		{
+			kept += matchEntry(filterMatches[row], filterOffsets[row], kept);
+		}
+	}
+	else
+	{
+		for (uint16_t index = 0; index < count; index++)
+		{
+			kept += matchEntry(index, 0, kept);
+		}
+	}
+
+	filterCount = kept;
+	filterTotal = count;
+	filterValid = true;
+}
+
+uint16_t filter_getCount(void)
+{
+	return filterCount;
+}
+
+uint16_t filter_getIndex(uint16_t row)
+{
+	return filterMatches[row];
+}
+
+uint16_t filter_findRow(uint16_t index)
+{
+	uint16_t low = 0;
+	uint16_t high = filterCount;
+	while (low < high)
+	{
+		uint16_t mid = (low + high) / 2;
+		if (filterMatches[mid] < index)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low < filterCount ? low : (filterCount ? filterCount - 1 : 0);
+}
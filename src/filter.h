@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Narrows the listing down to the entries whose names contain what has been
+// typed, ignoring case and anything but letters and digits (see
+// file_manager_get_shadow()). The matches are kept, along with where each one
+// matched, so typing another character only has to look at those again.
+// Only for listings held whole: not while loading, and not windowed.
+
+/// @brief Forget the matches; call whenever the listing changes.
+void filter_clear(void);
+
+/// @brief Match the first `count` entries against `text`, refining the last
+/// matches if `text` only adds to what they were matched against.
+void filter_set(const char *text, uint16_t count);
+
+uint16_t filter_getCount(void);
+
+/// @brief Listing index of match `row`.
+uint16_t filter_getIndex(uint16_t row);
+
+/// @brief Row of the first match at or after listing index `index`, or the
+/// last row if there is none.
+uint16_t filter_findRow(uint16_t index);
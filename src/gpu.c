@@ -96,7 +96,7 @@
 	 chain->nextPacket += numCommands + 1;
  
 	 *ptr = gp0_tag(numCommands, chain->nextPacket);
-	 assert(chain->nextPacket < &(chain->data)[CHAIN_BUFFER_SIZE]);
+	 assert(chain->nextPacket < chain->limit);
  
 	 return &ptr[1];
  }
@@ -25,6 +25,7 @@
 typedef struct {
 	uint32_t data[CHAIN_BUFFER_SIZE];
 	uint32_t *nextPacket;
+	uint32_t *limit; // allocatePacket() stays below this
 } DMAChain;
 
 typedef struct {
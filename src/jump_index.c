@@ -0,0 +1,104 @@
+#include "jump_index.h"
+
+#include <stddef.h>
+
+#include "listing.h"
+
+// Groups in display order, and the group of every indexed row, so moving to
+// either neighbour is a lookup rather than a search.
+static uint16_t jumpGroupStarts[JUMP_INDEX_GROUPS];
+static uint16_t jumpGroupKeys[JUMP_INDEX_GROUPS];
+static uint8_t jumpGroupOf[MAX_FILE_ITEMS];
+static uint8_t jumpGroups;
+static uint16_t jumpIndexed;
+
+// Folder flag in the high byte, upper-cased first letter or '#' in the low.
+static uint16_t groupKey(const fileData *file)
+{
+	char first = file->filename[0];
+	if (first >= 'a' && first <= 'z')
+	{
+		first -= 'a' - 'A';
+	}
+	else if (first < 'A' || first > 'Z')
+	{
+		first = '#';
+	}
+
+	return ((file->flag == 1) << 8) | (uint8_t)first;
+}
+
+void jump_index_clear(void)
+{
+	jumpGroups = 0;
+	jumpIndexed = 0;
+}
+
+void jump_index_update(uint16_t count)
+{
+	if (count > MAX_FILE_ITEMS)
+	{
+		count = MAX_FILE_ITEMS;
+	}
+
+	for (; jumpIndexed < count; jumpIndexed++)
+	{
+		const fileData *file = listing_getEntry(jumpIndexed);
+		if (!file)
+		{
+			return;
+		}
+
+		// A case-sensitive sort can split a letter in two ("Zoo" < "apple");
+		// that just makes two groups. Once out of groups, the last one grows.
+		uint16_t key = groupKey(file);
+		if (!jumpGroups || (jumpGroupKeys[jumpGroups - 1] != key && jumpGroups < JUMP_INDEX_GROUPS))
+		{
+			jumpGroupStarts[jumpGroups] = jumpIndexed;
+			jumpGroupKeys[jumpGroups] = key;
+			jumpGroups++;
+		}
+		jumpGroupOf[jumpIndexed] = jumpGroups - 1;
+	}
+}
+
+uint16_t jump_index_next(uint16_t index, uint16_t count)
+{
+	if (index < jumpIndexed && jumpGroupOf[index] + 1 < jumpGroups)
+	{
+		return jumpGroupStarts[jumpGroupOf[index] + 1];
+	}
+
+	// Past the last indexed group: carry on through the rows held after it
+	// until the letter changes or a row isn't there (yet). Either way the
+	// cursor moves on by at least one row.
+	const fileData *file = index < jumpIndexed ? NULL : listing_getEntry(index);
+	bool known = file || index < jumpIndexed;
+	uint16_t key = file ? groupKey(file) : (known ? jumpGroupKeys[jumpGroups - 1] : 0);
+	uint16_t next = jumpIndexed > index + 1 ? jumpIndexed : index + 1;
+	for (; known && next < count; next++)
+	{
+		const fileData *row = listing_getEntry(next);
+		if (!row || groupKey(row) != key)
+		{
+			break;
+		}
+	}
+
+	return next < count ? next : (count ? count - 1 : 0);
+}
+
+uint16_t jump_index_previous(uint16_t index)
+{
+	if (index >= jumpIndexed)
+	{
+		return jumpGroups ? jumpGroupStarts[jumpGroups - 1] : index;
+	}
+
+	uint8_t group = jumpGroupOf[index];
+	if (index == jumpGroupStarts[group] && group > 0)
+	{
+		group--;
+	}
+	return jumpGroupStarts[group];
+}
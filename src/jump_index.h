@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "file_manager.h"
+
+// Where each group of entries starting with the same letter begins, for
+// L2/R2. Folders and files are grouped separately, and any name that doesn't
+// start with a letter goes in a '#' group. Only the first MAX_FILE_ITEMS rows
+// of a windowed folder are indexed, and only as they are fetched.
+#define JUMP_INDEX_GROUPS 128
+
+/// @brief Forget the index; call whenever the rows change order or go away.
+void jump_index_clear(void);
+
+/// @brief Index rows [indexed so far, count). Rows must already be in their
+/// final order (see listing_isInOrder()); stops at the first one not held.
+void jump_index_update(uint16_t count);
+
+/// @brief First row of the group after the one `index` is in. Past the last
+/// indexed group, the first held row with another letter, else the first row
+/// not held, at least one row on and at most the last row.
+uint16_t jump_index_next(uint16_t index, uint16_t count);
+
+/// @brief First row of the group `index` is in, or of the one before if
+/// `index` already is.
+uint16_t jump_index_previous(uint16_t index);
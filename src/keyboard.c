@@ -0,0 +1,100 @@
+#include "keyboard.h"
+
+#include "controller.h"
+
+static const char keyboardLayout[KEYBOARD_ROWS][KEYBOARD_COLUMNS + 1] = {
+	"ABCDEFGHIJ",
+	"KLMNOPQRST",
+	"UVWXYZ0123",
+	"456789_-.'",
+};
+
+static char keyboardText[KEYBOARD_MAX_LENGTH + 1];
+static uint8_t keyboardLength;
+static uint8_t keyboardRow;
+static uint8_t keyboardColumn;
+static bool keyboardOpen;
+
+void keyboard_open(void)
+{
+	keyboardOpen = true;
+}
+
+bool keyboard_isOpen(void)
+{
+	return keyboardOpen;
+}
+
+KeyboardResult keyboard_update(uint16_t pressedButtons)
+{
+	if (!keyboardOpen)
+	{
+		return KEYBOARD_EDITING;
+	}
+
+	if (pressedButtons & BUTTON_MASK_UP)
+	{
+		keyboardRow = keyboardRow > 0 ? keyboardRow - 1 : KEYBOARD_ROWS - 1;
+	}
+	else if (pressedButtons & BUTTON_MASK_DOWN)
+	{
+		keyboardRow = keyboardRow < KEYBOARD_ROWS - 1 ? keyboardRow + 1 : 0;
+	}
+	if (pressedButtons & BUTTON_MASK_LEFT)
+	{
+		keyboardColumn = keyboardColumn > 0 ? keyboardColumn - 1 : KEYBOARD_COLUMNS - 1;
+	}
+	else if (pressedButtons & BUTTON_MASK_RIGHT)
+	{
+		keyboardColumn = keyboardColumn < KEYBOARD_COLUMNS - 1 ? keyboardColumn + 1 : 0;
+	}
+
+	if ((pressedButtons & BUTTON_MASK_X) && keyboardLength < KEYBOARD_MAX_LENGTH)
+	{
+		char key = keyboardLayout[keyboardRow][keyboardColumn];
+		keyboardText[keyboardLength++] = key == '_' ? ' ' : key;
+		keyboardText[keyboardLength] = 0;
+	}
+	if ((pressedButtons & BUTTON_MASK_SQUARE) && keyboardLength > 0)
+	{
+		keyboardText[--keyboardLength] = 0;
+	}
+
+	if ((pressedButtons & BUTTON_MASK_START) && keyboardLength > 0)
+	{
+		keyboardOpen = false;
+		return KEYBOARD_SUBMIT;
+	}
+	if (pressedButtons & BUTTON_MASK_TRIANGLE)
+	{
+		keyboardOpen = false;
+		return KEYBOARD_FILTER;
+	}
+	if (pressedButtons & BUTTON_MASK_CIRCLE)
+	{
+		keyboardOpen = false;
+		return KEYBOARD_CANCEL;
+	}
+
+	return KEYBOARD_EDITING;
+}
+
+char keyboard_getKey(uint8_t row, uint8_t column)
+{
+	return keyboardLayout[row][column];
+}
+
+uint8_t keyboard_getRow(void)
+{
+	return keyboardRow;
+}
+
+uint8_t keyboard_getColumn(void)
+{
+	return keyboardColumn;
+}
+
+const char *keyboard_getText(void)
+{
+	return keyboardText;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// On-screen keyboard for typing a search or a filter. It is fed the pressed buttons each
+// frame and keeps its text between uses; drawing it is up to the caller.
+#define KEYBOARD_MAX_LENGTH 32
+#define KEYBOARD_ROWS 4
+#define KEYBOARD_COLUMNS 10
+
+typedef enum {
+	KEYBOARD_EDITING = 0,
+	KEYBOARD_SUBMIT  = 1, // Start with some text typed
+	KEYBOARD_CANCEL  = 2, // Circle
+	KEYBOARD_FILTER  = 3  // Triangle, text or not
+} KeyboardResult;
+
+void keyboard_open(void);
+bool keyboard_isOpen(void);
+
+/// @brief Move with the d-pad, type with X, delete with Square.
+/// @return KEYBOARD_SUBMIT, KEYBOARD_FILTER or KEYBOARD_CANCEL on the frame
+/// the keyboard closes.
+KeyboardResult keyboard_update(uint16_t pressedButtons);
+
+/// @brief Character on a key; a space is drawn as '_'.
+char keyboard_getKey(uint8_t row, uint8_t column);
+uint8_t keyboard_getRow(void);
+uint8_t keyboard_getColumn(void);
+const char *keyboard_getText(void);
@@ -0,0 +1,1148 @@
+#include "listing.h"
+
+#include <string.h>
+
+#include "ps1/cdrom.h"
+#include "psxproject/cdrom.h"
+#include "file_manager.h"
+#include "picostation.h"
+
+static uint8_t listingPool[LISTING_POOL_SECTORS * LISTING_SECTOR_SIZE] __attribute__((aligned(4)));
+static uint16_t listingPoolUsed;
+
+// Two sets of raw 2340-byte sectors: while page N is being parsed out of one
+// of them, the drive is already transferring page N+1 into the other. Each
+// set is either a slice of the pool or, once that is full, a scratch buffer.
+static uint8_t listingBuffers[2][LISTING_MAX_BATCH_SECTORS * LISTING_SECTOR_SIZE] __attribute__((aligned(4)));
+static uint8_t *listingBufferPages[2];
+static uint8_t listingBufferSectors[2];
+static bool listingBufferRetained[2];
+
+static uint8_t prefetchBuffer[LISTING_SECTOR_SIZE] __attribute__((aligned(4)));
+static bool prefetchActive;
+static uint16_t prefetchId;
+
+// An IO_COMMAND_METADATA request goes out one word per listing_isMetadataReady()
+// call, each once the drive has acknowledged the one before, and its answer
+// is only read after the last.
+static uint16_t metadataWords[LISTING_METADATA_MAX + 1];
+static uint8_t metadataWordCount;
+static uint8_t metadataWordsSent;
+static uint8_t *metadataSector;
+static bool metadataInFlight;
+
+static ListingStateMachineState listingSMState = LISTING_SM_IDLE;
+static bool listingActive;
+static uint8_t listingCurrent;
+static uint8_t listingBatchSectors = 1;
+static uint16_t listingCount;
+static bool listingFirstPage;
+static bool listingCollated;
+static uint16_t listingGeneration;
+static bool listingReadFailed;
+static uint8_t listingRetries;
+static bool listingInPlace;
+static bool listingFull;
+static uint16_t listingLimit = MAX_FILE_ITEMS;
+// Scanning for where the next pages start goes on to here. A collated folder
+// whose pages don't give its size is read to the end past listingLimit, only
+// counting, so it is known by the time the window takes over.
+static uint16_t listingScanLimit = MAX_FILE_ITEMS;
+static uint16_t listingRead; // Entries read so far, counted ones included
+static uint16_t listingTotal; // Size of the folder from LISTING_PAGE_TOTAL, 0 if not given
+
+// Window mode. A collated folder that turns out to hold more than
+// MAX_FILE_ITEMS entries switches to it once that many are in. From then on
+// only the FILE_WINDOW_ENTRIES entries around the cursor are kept, entry n in
+// file manager slot n % FILE_WINDOW_ENTRIES, and pages are fetched by position
+// as the cursor moves, mostly ahead of it in the direction it last moved.
+// Entries are addressed with 16 bits, so a folder ends at 0xFFFF entries.
+#define LISTING_WINDOW_NEAR 32
+
+static bool listingWindowed;
+static uint16_t windowStart; // Entries [windowStart, windowEnd) are held
+static uint16_t windowEnd;
+static uint16_t windowAcceptStart; // Entries of the page being parsed to keep
+static uint16_t windowAcceptEnd;
+static uint16_t windowRequest; // First entry of the read in flight
+static bool windowBackward;    // It fills the window in behind windowStart
+static uint16_t windowPageEntries = 32; // Entries the last full page held
+static uint16_t windowCursor;
+static bool windowForward = true;
+
+// Compressed pages are unpacked here and their names copied out.
+static uint8_t listingDecoded[LISTING_DECODED_SIZE];
+
+static bool copyEntry(uint16_t index, uint16_t id, uint8_t flag, const char *name, uint16_t length)
+{
+	if (listingWindowed)
+	{
+		if (index >= windowAcceptStart && index < windowAcceptEnd)
+		{
+			file_manager_set_window_entry(index % FILE_WINDOW_ENTRIES, id, flag, name, length);
+		}
+		return true;
+	}
+
+	if (!file_manager_init_file_data(index, id, flag, name, length))
+	{
+		listingFull = true;
+		return false;
+	}
+	return true;
+}
+
+// Hands one parsed record to the file manager. In place, the name is
+// terminated by overwriting the byte after it, which is the next record's
+// length (or the page terminator), so callers must have read that first.
+static bool addEntry(uint16_t index, uint16_t id, uint8_t flag, char *name, uint16_t length)
+{
+	if (listingInPlace)
+	{
+		name[length] = 0;
+		file_manager_ref_file_data(index, id, flag, name, length);
+		return true;
+	}
+
+	return copyEntry(index, id, flag, name, length);
+}
+
+bool doLookup(uint16_t *itemCount, char *sectorBuffer)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+
+	uint16_t offset = 0;
+	uint16_t length = page[0];
+	while (offset < LISTING_SIZE && *itemCount < listingLimit)
+	{
+		if (length == 0)
+		{
+			return sectorBuffer[offset + 1] == 1 || (sectorBuffer[offset + 2] == 0 && sectorBuffer[offset + 3] == 0);
+		}
+
+		uint8_t flag = page[offset + 1];
+		char *name = &sectorBuffer[offset + 2];
+		offset += length + 2;
+		uint16_t nextLength = offset < LISTING_SIZE ? page[offset] : 0;
+
+		if (!addEntry(*itemCount, *itemCount, flag, name, length))
+		{
+			return false;
+		}
+		length = nextLength;
+		*itemCount = *itemCount + 1;
+	}
+
+	return false;
+}
+
+// Same walk as doLookup() but without copying anything out of the page, so the
+// entry count needed for the next request is known before parsing starts.
+static bool scanLookupV1(uint16_t *itemCount, const char *sectorBuffer)
+{
+	uint16_t offset = 0;
+	while (offset < LISTING_SIZE && *itemCount < listingScanLimit)
+	{
+		uint16_t length = ((const uint8_t *)sectorBuffer)[offset];
+		if (length == 0)
+		{
+			return sectorBuffer[offset + 1] == 1 || (sectorBuffer[offset + 2] == 0 && sectorBuffer[offset + 3] == 0);
+		}
+		offset += length + 2;
+		*itemCount = *itemCount + 1;
+	}
+
+	return false;
+}
+
+bool isListingV2(const char *sectorBuffer)
+{
+	return sectorBuffer[0] == LISTING_V2_MAGIC0 && sectorBuffer[1] == LISTING_V2_MAGIC1 && sectorBuffer[2] == LISTING_V2_VERSION;
+}
+
+// End of the part of a v2 page records can take up.
+static uint16_t payloadEnd(const uint8_t *page)
+{
+	return (page[3] & LISTING_PAGE_TOTAL) ? LISTING_SIZE - LISTING_TOTAL_SIZE : LISTING_SIZE;
+}
+
+// Returns the decoded size, or 0 if the stream doesn't produce exactly
+// decodedSize bytes without reaching outside either buffer.
+uint16_t listing_decompress(const uint8_t *input, uint16_t inputSize, uint8_t *output, uint16_t decodedSize)
+{
+	uint16_t in = 0;
+	uint16_t out = 0;
+	while (out < decodedSize)
+	{
+		if (in >= inputSize)
+		{
+			return 0;
+		}
+
+		uint8_t control = input[in++];
+		for (uint8_t bit = 0; bit < 8 && out < decodedSize; bit++, control >>= 1)
+		{
+			if (!(control & 1))
+			{
+				if (in >= inputSize)
+				{
+					return 0;
+				}
+				output[out++] = input[in++];
+				continue;
+			}
+
+			if (in + 2 > inputSize)
+			{
+				return 0;
+			}
+			uint16_t distance = (input[in] | ((input[in + 1] >> 4) << 8)) + 1;
+			uint16_t length = (input[in + 1] & 0x0F) + 3;
+			in += 2;
+
+			if (distance > out || out + length > decodedSize)
+			{
+				return 0;
+			}
+
+			// Byte by byte on purpose: matches may overlap their own output.
+			const uint8_t *from = &output[out - distance];
+			for (uint16_t i = 0; i < length; i++)
+			{
+				output[out + i] = from[i];
+			}
+			out += length;
+		}
+	}
+
+	return out;
+}
+
+static bool doLookupCompressed(uint16_t *itemCount, const char *sectorBuffer)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+	bool hasNext = !(page[3] & LISTING_PAGE_LAST);
+
+	const uint8_t *payload = &page[LISTING_V2_HEADER_SIZE];
+	uint16_t decodedSize = payload[2] | (payload[3] << 8);
+	if (decodedSize > LISTING_DECODED_SIZE)
+	{
+		return false;
+	}
+
+	const uint16_t streamOffset = LISTING_V2_HEADER_SIZE + LISTING_COMPRESSED_HEADER_SIZE;
+	if (listing_decompress(&page[streamOffset], payloadEnd(page) - streamOffset, listingDecoded, decodedSize) != decodedSize)
+	{
+		return false;
+	}
+
+	// Each name is rebuilt on top of the previous one, then copied out.
+	char name[MAX_FILE_LENGTH + 1];
+	uint16_t offset = 0;
+	while (offset + LISTING_COMPRESSED_RECORD_HEADER <= decodedSize && *itemCount < listingLimit)
+	{
+		const uint8_t *record = &listingDecoded[offset];
+		uint16_t prefix = record[0];
+		uint16_t suffix = record[1];
+		if (prefix + suffix > MAX_FILE_LENGTH || offset + LISTING_COMPRESSED_RECORD_HEADER + suffix > decodedSize)
+		{
+			return false;
+		}
+
+		memcpy(&name[prefix], &record[LISTING_COMPRESSED_RECORD_HEADER], suffix);
+
+		uint16_t id = record[3] | (record[4] << 8);
+		uint8_t flag = (record[2] & LISTING_RECORD_DIRECTORY) ? 1 : 0;
+		if (!copyEntry(*itemCount, id, flag, name, prefix + suffix))
+		{
+			return false;
+		}
+		offset += LISTING_COMPRESSED_RECORD_HEADER + suffix;
+		*itemCount = *itemCount + 1;
+	}
+
+	return hasNext && *itemCount < listingLimit;
+}
+
+bool doLookupV2(uint16_t *itemCount, char *sectorBuffer)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+	if (page[3] & LISTING_PAGE_COMPRESSED)
+	{
+		return doLookupCompressed(itemCount, sectorBuffer);
+	}
+
+	bool hasNext = !(page[3] & LISTING_PAGE_LAST);
+	uint16_t end = payloadEnd(page);
+
+	uint16_t offset = LISTING_V2_HEADER_SIZE;
+	uint16_t length = page[offset];
+	while (offset < end && *itemCount < listingLimit)
+	{
+		if (length == 0)
+		{
+			break;
+		}
+
+		uint16_t id = page[offset + 2] | (page[offset + 3] << 8);
+		uint8_t flag = (page[offset + 1] & LISTING_RECORD_DIRECTORY) ? 1 : 0;
+		char *name = &sectorBuffer[offset + LISTING_V2_RECORD_HEADER];
+		offset += length + LISTING_V2_RECORD_HEADER;
+		uint16_t nextLength = offset < end ? page[offset] : 0;
+
+		if (!addEntry(*itemCount, id, flag, name, length))
+		{
+			return false;
+		}
+		length = nextLength;
+		*itemCount = *itemCount + 1;
+	}
+
+	return hasNext && *itemCount < listingLimit;
+}
+
+static bool scanLookupV2(uint16_t *itemCount, const char *sectorBuffer)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+	bool hasNext = !(page[3] & LISTING_PAGE_LAST);
+
+	// Compressed pages say up front how many entries they hold.
+	if (page[3] & LISTING_PAGE_COMPRESSED)
+	{
+		uint16_t entries = page[LISTING_V2_HEADER_SIZE] | (page[LISTING_V2_HEADER_SIZE + 1] << 8);
+		*itemCount = *itemCount + entries < listingScanLimit ? *itemCount + entries : listingScanLimit;
+		return hasNext && *itemCount < listingScanLimit;
+	}
+
+	uint16_t end = payloadEnd(page);
+	uint16_t offset = LISTING_V2_HEADER_SIZE;
+	while (offset < end && *itemCount < listingScanLimit)
+	{
+		uint16_t length = page[offset];
+		if (length == 0)
+		{
+			break;
+		}
+		offset += length + LISTING_V2_RECORD_HEADER;
+		*itemCount = *itemCount + 1;
+	}
+
+	return hasNext && *itemCount < listingScanLimit;
+}
+
+uint16_t listing_checksum(const char *sectorBuffer)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+
+	// Fletcher-16. Neither sum can overflow 32 bits over a single page, so
+	// the modulo is only taken once at the end.
+	uint32_t sum1 = 0;
+	uint32_t sum2 = 0;
+	for (uint16_t offset = LISTING_V2_HEADER_SIZE; offset < LISTING_SIZE; offset++)
+	{
+		sum1 += page[offset];
+		sum2 += sum1;
+	}
+
+	return ((sum2 % 255) << 8) | (sum1 % 255);
+}
+
+// Checks that a page is the one that was asked for and arrived intact. v1
+// pages carry nothing to check against beyond their flag bytes.
+static bool isPageValid(const char *sectorBuffer, uint16_t firstEntry)
+{
+	const uint8_t *page = (const uint8_t *)sectorBuffer;
+
+	if (isListingV2(sectorBuffer))
+	{
+		if (!(page[3] & LISTING_PAGE_CHECKED))
+		{
+			return true;
+		}
+
+		uint16_t sequence = page[4] | (page[5] << 8);
+		uint16_t checksum = page[6] | (page[7] << 8);
+		return sequence == firstEntry && checksum == listing_checksum(sectorBuffer);
+	}
+
+	uint16_t offset = 0;
+	while (offset < LISTING_SIZE)
+	{
+		uint16_t length = page[offset];
+		if (length == 0)
+		{
+			break;
+		}
+		if (page[offset + 1] > 1)
+		{
+			return false;
+		}
+		offset += length + 2;
+	}
+
+	return true;
+}
+
+static bool lookupPage(uint16_t *itemCount, char *sectorBuffer)
+{
+	if (isListingV2(sectorBuffer))
+	{
+		return doLookupV2(itemCount, sectorBuffer);
+	}
+
+	return doLookup(itemCount, sectorBuffer);
+}
+
+static bool scanLookup(uint16_t *itemCount, const char *sectorBuffer)
+{
+	if (isListingV2(sectorBuffer))
+	{
+		return scanLookupV2(itemCount, sectorBuffer);
+	}
+
+	return scanLookupV1(itemCount, sectorBuffer);
+}
+
+bool doLookupSectors(uint16_t *itemCount, uint8_t *sectors, uint8_t numSectors)
+{
+	bool hasNext = false;
+	for (uint8_t i = 0; i < numSectors; i++)
+	{
+		hasNext = lookupPage(itemCount, (char *)&sectors[i * LISTING_SECTOR_SIZE + LISTING_HEADER_SIZE]);
+		if (!hasNext)
+		{
+			break;
+		}
+	}
+
+	return hasNext;
+}
+
+// Walks the pages like doLookupSectors() without parsing them, and stores how
+// many it got through in usedSectors, up to and including the one it stopped
+// on. With `check`, stops before the first page that fails isPageValid(),
+// returning true; *itemCount is then the first entry of that page.
+static bool scanLookupSectors(uint16_t *itemCount, const uint8_t *sectors, uint8_t numSectors, bool check, uint8_t *usedSectors)
+{
+	bool hasNext = false;
+	uint8_t i = 0;
+	while (i < numSectors)
+	{
+		const char *page = (const char *)&sectors[i * LISTING_SECTOR_SIZE + LISTING_HEADER_SIZE];
+		if (check && !isPageValid(page, *itemCount))
+		{
+			*usedSectors = i;
+			return true;
+		}
+
+		hasNext = scanLookup(itemCount, page);
+		i++;
+		if (!hasNext)
+		{
+			break;
+		}
+	}
+
+	*usedSectors = i;
+	return hasNext;
+}
+
+static void requestPages(uint8_t command, uint16_t argument, uint8_t buffer, uint8_t numSectors)
+{
+	listingBufferSectors[buffer] = numSectors;
+	listingBufferRetained[buffer] = listingPoolUsed + numSectors <= LISTING_POOL_SECTORS;
+	listingBufferPages[buffer] = listingBufferRetained[buffer]
+		? &listingPool[listingPoolUsed * LISTING_SECTOR_SIZE]
+		: listingBuffers[buffer];
+
+	sendCommand(command, argument);
+	startCDROMRead(
+		LISTING_LBA,
+		listingBufferPages[buffer],
+		numSectors,
+		LISTING_SECTOR_SIZE,
+		true,
+		false);
+}
+
+static void requestNextPages(uint16_t firstEntry, uint8_t buffer)
+{
+	// Batches only carry 12 bits of the first entry; counting past that goes
+	// a page at a time.
+	if (listingBatchSectors > 1 && firstEntry <= 0xFFF)
+	{
+		requestPages(
+			COMMAND_GET_CONTENTS_BATCH,
+			((listingBatchSectors - 1) << 12) | (firstEntry & 0xFFF),
+			buffer,
+			listingBatchSectors);
+	}
+	else
+	{
+		requestPages(COMMAND_GET_NEXT_CONTENTS, firstEntry, buffer, 1);
+	}
+}
+
+static bool isPageReady(void)
+{
+	// INT1 fires once per sector, so wait for the sector count the interrupt
+	// handler decrements to run out. An error (INT5) also ends the read; the
+	// pages are parsed as-is, like the blocking read always did.
+	return (!waitingForInt1 && !cdromReadDataNumSectors) || !waitingForInt5;
+}
+
+void listing_setBatchSectors(uint8_t numSectors)
+{
+	if (numSectors < 1)
+	{
+		numSectors = 1;
+	}
+	if (numSectors > LISTING_MAX_BATCH_SECTORS)
+	{
+		numSectors = LISTING_MAX_BATCH_SECTORS;
+	}
+	listingBatchSectors = numSectors;
+}
+
+static void waitForPage(void)
+{
+	while (!isPageReady())
+	{
+		__asm__ volatile("");
+	}
+}
+
+static void discardPrefetch(void)
+{
+	if (!prefetchActive)
+	{
+		return;
+	}
+
+	waitForPage();
+	sendCommand(COMMAND_GOTO_PARENT, 0);
+	prefetchActive = false;
+}
+
+// Sends the next word of a metadata request if the last one has been
+// acknowledged, and starts reading the answer once they are all out.
+static void sendMetadataWord(void)
+{
+	if (waitingForInt3 && waitingForInt5)
+	{
+		return;
+	}
+
+	if (metadataWordsSent < metadataWordCount)
+	{
+		sendCommand(COMMAND_IO_DATA, metadataWords[metadataWordsSent++]);
+		return;
+	}
+
+	metadataWordCount = 0;
+	startCDROMRead(
+		LISTING_LBA,
+		metadataSector,
+		1,
+		LISTING_SECTOR_SIZE,
+		true,
+		false);
+}
+
+// Gets the drive and the firmware back to the current folder with nothing in
+// flight on their side, so a new command can be sent.
+static void settleDrive(void)
+{
+	while (metadataWordCount)
+	{
+		waitForINT3();
+		sendMetadataWord();
+	}
+	if (metadataInFlight)
+	{
+		waitForPage();
+		metadataInFlight = false;
+	}
+	discardPrefetch();
+}
+
+static void resetListing(void)
+{
+	listingWindowed = false;
+	listingLimit = MAX_FILE_ITEMS;
+	listingScanLimit = MAX_FILE_ITEMS;
+	listingCount = 0;
+	listingRead = 0;
+	listingTotal = 0;
+	listingCurrent = 0;
+	listingFirstPage = true;
+	listingGeneration = 0;
+	listingRetries = 0;
+	listingPoolUsed = 0;
+	listingFull = false;
+	listingActive = true;
+	file_manager_clear();
+}
+
+void listing_start(uint8_t command, uint16_t argument)
+{
+	listing_cancel();
+
+	resetListing();
+	requestPages(command, argument, listingCurrent, 1);
+	listingSMState = LISTING_SM_WAIT_FOR_DATA;
+}
+
+void listing_startPath(const char *path)
+{
+	listing_cancel();
+
+	resetListing();
+	sendString(IO_COMMAND_GOTO_PATH, path);
+	requestPages(COMMAND_GET_NEXT_CONTENTS, 0, listingCurrent, 1);
+	listingSMState = LISTING_SM_WAIT_FOR_DATA;
+}
+
+void listing_startSearch(const char *query)
+{
+	listing_cancel();
+
+	resetListing();
+	sendString(IO_COMMAND_SEARCH, query);
+	requestPages(COMMAND_GET_NEXT_CONTENTS, 0, listingCurrent, 1);
+	listingSMState = LISTING_SM_WAIT_FOR_DATA;
+}
+
+void listing_prefetch(uint16_t id)
+{
+	// A windowed folder may be reading around the cursor; the drive and the
+	// firmware are only free between its reads.
+	if (listingActive || listingSMState != LISTING_SM_IDLE || (prefetchActive && prefetchId == id))
+	{
+		return;
+	}
+
+	settleDrive();
+
+	sendCommand(COMMAND_GOTO_DIRECTORY, id);
+	startCDROMRead(
+		LISTING_LBA,
+		prefetchBuffer,
+		1,
+		LISTING_SECTOR_SIZE,
+		true,
+		false);
+	prefetchActive = true;
+	prefetchId = id;
+}
+
+bool listing_startPrefetched(uint16_t id)
+{
+	if (!prefetchActive || prefetchId != id || listingActive)
+	{
+		return false;
+	}
+
+	// The firmware is already in the directory; carry on from its first page
+	// as if listing_start() had asked for it. It may still be landing.
+	prefetchActive = false;
+	resetListing();
+	listingBufferPages[listingCurrent] = prefetchBuffer;
+	listingBufferSectors[listingCurrent] = 1;
+	listingBufferRetained[listingCurrent] = false;
+	listingSMState = LISTING_SM_WAIT_FOR_DATA;
+	return true;
+}
+
+static void requestWindowPage(uint16_t firstEntry, bool backward)
+{
+	// The firmware has to be back in this folder before asking it for more.
+	settleDrive();
+
+	windowRequest = firstEntry;
+	windowBackward = backward;
+	sendCommand(COMMAND_GET_NEXT_CONTENTS, firstEntry);
+	startCDROMRead(
+		LISTING_LBA,
+		listingBuffers[0],
+		1,
+		LISTING_SECTOR_SIZE,
+		true,
+		false);
+	listingSMState = LISTING_SM_WAIT_FOR_DATA;
+}
+
+static bool startWindow(uint16_t count)
+{
+	if (!file_manager_start_window())
+	{
+		return false;
+	}
+
+	listingPoolUsed = 0;
+	listingWindowed = true;
+	listingActive = false;
+	listingCount = count;
+	listingLimit = 0xFFFF;
+	listingScanLimit = 0xFFFF;
+	listingRetries = 0;
+	windowStart = windowCursor;
+	windowEnd = windowCursor;
+	listingSMState = LISTING_SM_IDLE;
+	return true;
+}
+
+// First entry the window should hold: a quarter of it goes behind the cursor,
+// three quarters ahead, in the direction it last moved.
+static uint16_t windowLow(void)
+{
+	uint16_t behind = windowForward ? FILE_WINDOW_ENTRIES / 4 : FILE_WINDOW_ENTRIES * 3 / 4;
+	return windowCursor > behind ? windowCursor - behind : 0;
+}
+
+// Picks the next page to read, if any: whatever the window is missing in the
+// direction the cursor is going, then behind it.
+static void scheduleWindow(void)
+{
+	uint16_t cursor = windowCursor;
+	uint16_t low = windowLow();
+	uint32_t high = (uint32_t)low + FILE_WINDOW_ENTRIES;
+
+	// Jumped away from what is held: start over from the cursor.
+	if (cursor < windowStart || cursor > windowEnd)
+	{
+		windowStart = cursor;
+		windowEnd = cursor;
+	}
+
+	bool wantAhead = windowEnd < high && windowEnd < listingCount;
+	bool wantBehind = windowStart > low;
+
+	// Whatever is about to be on screen, starting with the cursor row, comes
+	// before reading further in either direction.
+	if (wantAhead && windowEnd - cursor < LISTING_WINDOW_NEAR)
+	{
+		wantBehind = false;
+	}
+	else if (wantBehind && cursor - windowStart < LISTING_WINDOW_NEAR)
+	{
+		wantAhead = false;
+	}
+
+	if (wantAhead && (windowForward || !wantBehind))
+	{
+		requestWindowPage(windowEnd, false);
+	}
+	else if (wantBehind)
+	{
+		// Step back by a bit less than a page, so the page most likely runs
+		// into what is already held.
+		uint16_t step = windowPageEntries * 3 / 4 + 1;
+		requestWindowPage(windowStart > step ? windowStart - step : 0, true);
+	}
+}
+
+static void updateWindow(void)
+{
+	if (listingSMState == LISTING_SM_WAIT_FOR_DATA)
+	{
+		if (!isPageReady())
+		{
+			return;
+		}
+		listingReadFailed = !waitingForInt5;
+		listingSMState = LISTING_SM_DATA_READY;
+	}
+
+	if (listingSMState == LISTING_SM_DATA_READY)
+	{
+		char *page = (char *)&listingBuffers[0][LISTING_HEADER_SIZE];
+		if ((listingReadFailed || !isPageValid(page, windowRequest)) && listingRetries < LISTING_MAX_RETRIES)
+		{
+			listingRetries++;
+			requestWindowPage(windowRequest, windowBackward);
+			return;
+		}
+		listingRetries = 0;
+
+		uint16_t pageEnd = windowRequest;
+		bool hasNext = scanLookup(&pageEnd, page);
+		if (!windowBackward && hasNext && pageEnd > windowRequest)
+		{
+			windowPageEntries = pageEnd - windowRequest;
+		}
+
+		uint16_t low = windowLow();
+		windowAcceptStart = 0;
+		windowAcceptEnd = 0;
+		if (windowBackward && pageEnd >= windowStart)
+		{
+			// Fills in up to what is held, pushing entries out at the far end,
+			// but nothing from before the part worth keeping.
+			windowAcceptStart = windowRequest > low ? windowRequest : low;
+			if (windowAcceptStart > windowStart)
+			{
+				windowAcceptStart = windowStart;
+			}
+			windowAcceptEnd = windowStart;
+			windowStart = windowAcceptStart;
+			if (windowEnd - windowStart > FILE_WINDOW_ENTRIES)
+			{
+				windowEnd = windowStart + FILE_WINDOW_ENTRIES;
+			}
+		}
+		else if (windowBackward)
+		{
+			// Stopped short of the window; step back less next time.
+			windowPageEntries = pageEnd - windowRequest;
+		}
+		else if (windowRequest == windowEnd)
+		{
+			// Carries on from windowEnd without pushing out the part behind
+			// the cursor worth keeping.
+			uint32_t keepEnd = (uint32_t)(low > windowStart ? low : windowStart) + FILE_WINDOW_ENTRIES;
+			windowAcceptStart = windowEnd;
+			windowAcceptEnd = pageEnd < keepEnd ? pageEnd : keepEnd;
+			if (windowAcceptEnd > windowEnd)
+			{
+				windowEnd = windowAcceptEnd;
+			}
+			if (windowEnd - windowStart > FILE_WINDOW_ENTRIES)
+			{
+				windowStart = windowEnd - FILE_WINDOW_ENTRIES;
+			}
+		}
+
+		uint16_t itemCount = windowRequest;
+		lookupPage(&itemCount, page);
+
+		// The folder has grown since it was sized.
+		if (pageEnd > listingCount)
+		{
+			listingCount = pageEnd;
+		}
+		listingSMState = LISTING_SM_IDLE;
+	}
+
+	if (listingSMState == LISTING_SM_IDLE)
+	{
+		scheduleWindow();
+	}
+}
+
+bool listing_update(void)
+{
+	if (listingWindowed)
+	{
+		updateWindow();
+		return false;
+	}
+
+	// Wait For Data:
+	// A page has been requested. Once its sector has been DMA'd into RAM,
+	// change state to Data Ready.
+	if (listingSMState == LISTING_SM_WAIT_FOR_DATA)
+	{
+		if (isPageReady())
+		{
+			listingReadFailed = !waitingForInt5;
+			listingSMState = LISTING_SM_DATA_READY;
+		}
+	}
+
+	// Data Ready:
+	// Work out where the next pages start, put the drive to work on them and
+	// parse these while it does.
+	if (listingSMState == LISTING_SM_DATA_READY)
+	{
+		uint8_t *pages = listingBufferPages[listingCurrent];
+		uint8_t numSectors = listingBufferSectors[listingCurrent];
+
+		// Ran out of room for names on the previous pages. Entries past that
+		// point would get the wrong firmware index on v1, so the read that
+		// was already under way is dropped and the listing ends there.
+		if (listingFull)
+		{
+			numSectors = 0;
+			listingReadFailed = false;
+		}
+
+		uint16_t nextEntry = listingRead;
+		uint8_t validSectors = 0;
+		bool hasNext = !listingFull;
+		if (!listingReadFailed)
+		{
+			hasNext = scanLookupSectors(&nextEntry, pages, numSectors, true, &validSectors) && !listingFull;
+		}
+
+		// Pages after the folder's last one are never looked at.
+		if (hasNext && validSectors < numSectors)
+		{
+			if (listingRetries < LISTING_MAX_RETRIES)
+			{
+				// Keep the good pages and ask again from the first bad one.
+				listingRetries++;
+			}
+			else
+			{
+				// Still broken; parse it as-is rather than getting stuck.
+				nextEntry = listingRead;
+				hasNext = scanLookupSectors(&nextEntry, pages, numSectors, false, &validSectors);
+				listingRetries = 0;
+			}
+		}
+		else
+		{
+			listingRetries = 0;
+		}
+
+		// Only v2 firmware collates listings, and it does so for every page
+		// of a folder, so the first page decides whether sorting is needed.
+		if (listingFirstPage && validSectors > 0)
+		{
+			const uint8_t *first = &pages[LISTING_HEADER_SIZE];
+			listingCollated = isListingV2((const char *)first);
+			listingGeneration = listingCollated ? first[8] | (first[9] << 8) : 0;
+			listingFirstPage = false;
+
+			// Without its size, a collated folder is counted as it streams
+			// in, so that it can be windowed once the last page is in.
+			if (listingCollated && (first[3] & LISTING_PAGE_TOTAL))
+			{
+				listingTotal = first[LISTING_SIZE - 2] | (first[LISTING_SIZE - 1] << 8);
+			}
+			else if (listingCollated)
+			{
+				listingScanLimit = 0xFFFF;
+			}
+		}
+		listingRead = nextEntry;
+
+		// Good pages in the pool stay there, up to the folder's last one; the
+		// next read goes after them.
+		if (listingBufferRetained[listingCurrent])
+		{
+			listingPoolUsed += validSectors;
+		}
+
+		if (hasNext)
+		{
+			requestNextPages(nextEntry, listingCurrent ^ 1);
+		}
+
+		if (listingCount < listingLimit)
+		{
+			listingInPlace = listingBufferRetained[listingCurrent];
+			doLookupSectors(&listingCount, pages, validSectors);
+			listingInPlace = false;
+		}
+
+		// Sort what just arrived while the drive fetches the next pages, so
+		// only a merge is left once the last one is in.
+		if (!listingCollated)
+		{
+			file_manager_sort_run(listingCount);
+		}
+
+		if (hasNext)
+		{
+			listingCurrent ^= 1;
+			listingSMState = LISTING_SM_WAIT_FOR_DATA;
+			return false;
+		}
+
+		// Only part of a collated folder is held: page through it by
+		// position instead, if there is room for the window.
+		uint16_t folderSize = listingTotal > listingRead ? listingTotal : listingRead;
+		if (listingCollated && folderSize > listingCount && startWindow(folderSize))
+		{
+			scheduleWindow();
+			return true;
+		}
+
+		if (!listingCollated)
+		{
+			file_manager_merge_runs(listingCount);
+			file_manager_clean_list(&listingCount);
+		}
+		listingActive = false;
+		listingSMState = LISTING_SM_IDLE;
+		return true;
+	}
+
+	return false;
+}
+
+void listing_cancel(void)
+{
+	if (listingSMState == LISTING_SM_WAIT_FOR_DATA)
+	{
+		waitForPage();
+	}
+	settleDrive();
+
+	listingActive = false;
+	listingWindowed = false;
+	listingLimit = MAX_FILE_ITEMS;
+	listingScanLimit = MAX_FILE_ITEMS;
+	listingSMState = LISTING_SM_IDLE;
+}
+
+uint16_t listing_load(uint8_t command, uint16_t argument)
+{
+	listing_start(command, argument);
+	while (!listing_update())
+	{
+		__asm__ volatile("");
+	}
+
+	return listingCount;
+}
+
+bool listing_refresh(uint16_t *count)
+{
+	bool wasLoading = listingActive || listingWindowed;
+	listing_cancel();
+	if (wasLoading || !listingGeneration)
+	{
+		return false;
+	}
+
+	// Nothing in the scratch buffers is referenced once a listing is done.
+	uint8_t *sector = listingBuffers[0];
+	sendCommand(COMMAND_GET_CHANGES, listingGeneration);
+	startCDROMRead(
+		LISTING_LBA,
+		sector,
+		1,
+		LISTING_SECTOR_SIZE,
+		true,
+		true);
+
+	const uint8_t *page = &sector[LISTING_HEADER_SIZE];
+	uint16_t since = page[4] | (page[5] << 8);
+	uint16_t checksum = page[6] | (page[7] << 8);
+	if (!waitingForInt5 || page[0] != LISTING_V2_MAGIC0 || page[1] != LISTING_CHANGES_MAGIC1 ||
+		page[2] != LISTING_V2_VERSION || (page[3] & LISTING_CHANGES_RESET) || since != listingGeneration ||
+		checksum != listing_checksum((const char *)page))
+	{
+		return false;
+	}
+
+	uint16_t offset = LISTING_V2_HEADER_SIZE;
+	while (offset < LISTING_SIZE && page[offset] != 0)
+	{
+		uint16_t length = page[offset];
+		uint8_t flags = page[offset + 1];
+		uint16_t id = page[offset + 2] | (page[offset + 3] << 8);
+		const char *name = (const char *)&page[offset + LISTING_V2_RECORD_HEADER];
+
+		if (flags & LISTING_RECORD_REMOVED)
+		{
+			file_manager_remove_id(id, count);
+		}
+		else if (!file_manager_insert_sorted(id, (flags & LISTING_RECORD_DIRECTORY) ? 1 : 0, name, length, count))
+		{
+			return false;
+		}
+		offset += length + LISTING_V2_RECORD_HEADER;
+	}
+
+	listingGeneration = page[8] | (page[9] << 8);
+	listingCount = *count;
+	return true;
+}
+
+uint16_t listing_getGeneration(void)
+{
+	return listingGeneration;
+}
+
+void listing_setGeneration(uint16_t generation)
+{
+	listingGeneration = generation;
+}
+
+bool listing_isLoading(void)
+{
+	return listingActive;
+}
+
+bool listing_isInOrder(void)
+{
+	return listingCollated || !listingActive;
+}
+
+uint16_t listing_getCount(void)
+{
+	return listingCount;
+}
+
+fileData *listing_getEntry(uint16_t index)
+{
+	if (!listingWindowed)
+	{
+		return file_manager_get_file_data(index);
+	}
+
+	if (index < windowStart || index >= windowEnd)
+	{
+		return NULL;
+	}
+	return file_manager_get_file_data(index % FILE_WINDOW_ENTRIES);
+}
+
+void listing_setCursor(uint16_t index)
+{
+	if (index != windowCursor)
+	{
+		windowForward = index > windowCursor;
+		windowCursor = index;
+	}
+}
+
+bool listing_isWindowed(void)
+{
+	return listingWindowed;
+}
+
+bool listing_requestMetadata(const uint16_t *ids, uint8_t count, uint8_t *sector)
+{
+	if (listingActive || listingSMState != LISTING_SM_IDLE || !listing_isMetadataReady() || !count)
+	{
+		return false;
+	}
+	if (count > LISTING_METADATA_MAX)
+	{
+		count = LISTING_METADATA_MAX;
+	}
+
+	discardPrefetch();
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		metadataWords[i] = ids[i];
+	}
+	metadataWords[count] = 0xFFFF;
+	metadataWordCount = count + 1;
+	metadataWordsSent = 0;
+	metadataSector = sector;
+	metadataInFlight = true;
+
+	sendCommand(COMMAND_IO_COMMAND, IO_COMMAND_METADATA);
+	return true;
+}
+
+bool listing_isMetadataReady(void)
+{
+	if (metadataWordCount)
+	{
+		sendMetadataWord();
+	}
+	else if (metadataInFlight && isPageReady())
+	{
+		metadataInFlight = false;
+	}
+
+	return !metadataInFlight;
+}
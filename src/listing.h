@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "file_manager.h"
+
+// The firmware answers every listing command by placing one page of entries
+// in a Mode 2 sector at LBA 100. Each entry is a length byte, a flag byte
+// (1 = directory) and the unterminated name; a zero length ends the page.
+//
+// Firmware that collates listings itself sends v2 pages instead: a
+// LISTING_V2_HEADER_SIZE header starting with "PL\x02", then records made of
+// a length byte, a LISTING_RECORD_* flag byte, the 16-bit little endian
+// firmware index and the name. v2 records arrive already in display order
+// (directories first, sorted) with the .bin half of each bin/cue pair left
+// out, so they are appended as-is. A v1 page can never look like a v2 header
+// as its second byte is always 0 or 1.
+//
+// Bytes 8-9 of a v2 header hold the directory's generation, which the
+// firmware bumps whenever the folder changes (0 if it doesn't keep one).
+//
+// A v2 page flagged LISTING_PAGE_CHECKED also carries the index of its first
+// entry and a Fletcher-16 checksum of everything after the header. A page
+// that fails either check (or comes from a read that raised an error) is
+// requested again by that index, up to LISTING_MAX_RETRIES times, while the
+// pages before it are kept.
+//
+// A v2 page flagged LISTING_PAGE_COMPRESSED carries, after the header, the
+// number of entries on the page and the decoded size (both 16-bit little
+// endian), then an LZSS stream. Each control byte covers the next eight
+// items, least significant bit first: a 0 bit is a literal byte, a 1 bit a
+// two-byte match of 3 to 18 bytes up to 4096 bytes back
+// (offset - 1 = b0 | (b1 >> 4) << 8, length - 3 = b1 & 0x0F). The decoded
+// records are front-coded: a byte giving how much of the previous name on
+// the page is reused, the length of the rest, the record flags, the 16-bit
+// firmware index and the rest of the name.
+//
+// A v2 page flagged LISTING_PAGE_TOTAL ends with the number of entries in the
+// whole folder (16-bit little endian) in its last LISTING_TOTAL_SIZE bytes,
+// which its records stop short of. Firmware only adds it for menus that send
+// MENU_ACCEPTS_TOTAL.
+#define LISTING_LBA 100
+#define LISTING_SECTOR_SIZE 2340
+#define LISTING_HEADER_SIZE 12
+#define LISTING_SIZE 2324
+
+// Upper bound for listing_setBatchSectors(). Each of the two listing buffers
+// holds this many sectors.
+#define LISTING_MAX_BATCH_SECTORS 4
+
+// Sectors are read into this pool and kept for as long as the listing is on
+// screen, so entries can point at their names inside the page instead of
+// copying them out. Pages past the end of the pool go through the two
+// listing buffers and have their names copied into the file manager.
+#define LISTING_POOL_SECTORS 64
+
+#define LISTING_V2_MAGIC0 'P'
+#define LISTING_V2_MAGIC1 'L'
+#define LISTING_V2_VERSION 2
+#define LISTING_V2_HEADER_SIZE 10
+#define LISTING_V2_RECORD_HEADER 4
+
+// v2 page header flags
+#define LISTING_PAGE_LAST    (1 << 0) // No pages after this one
+#define LISTING_PAGE_CHECKED (1 << 1) // Sequence and checksum fields are valid
+#define LISTING_PAGE_COMPRESSED (1 << 2) // Payload is front-coded and LZSS packed
+#define LISTING_PAGE_TOTAL   (1 << 3) // Ends with the folder's entry count
+
+#define LISTING_TOTAL_SIZE 2
+
+#define LISTING_COMPRESSED_HEADER_SIZE 4
+#define LISTING_COMPRESSED_RECORD_HEADER 5
+#define LISTING_DECODED_SIZE 8192
+
+#define LISTING_MAX_RETRIES 3
+
+// Frames the cursor has to rest on a folder before the menu prefetches its
+// listing (listing_prefetch()).
+#define PREFETCH_DELAY_FRAMES 20
+
+// v2 record flags
+#define LISTING_RECORD_DIRECTORY (1 << 0)
+#define LISTING_RECORD_CUE       (1 << 1) // Cue sheet whose .bin files were folded into it
+#define LISTING_RECORD_AUDIO     (1 << 2) // Image without a data track
+#define LISTING_RECORD_REMOVED   (1 << 3) // Changes only: entry is gone
+
+// COMMAND_GET_CHANGES answers with a single page shaped like a checked v2
+// page but starting with "PD\x02". In place of the sequence number it echoes
+// the generation the changes were asked from, and its records are the entries
+// added since then plus the removed ones, flagged LISTING_RECORD_REMOVED.
+// Firmware indices of the other entries stay as they were. If the firmware
+// can't tell what changed, or it doesn't fit in a page, it sets
+// LISTING_CHANGES_RESET and the folder has to be listed again.
+#define LISTING_CHANGES_MAGIC1 'D'
+#define LISTING_CHANGES_RESET (1 << 3)
+
+// IO_COMMAND_METADATA is answered with a single checked page starting with
+// "PM\x02". Bytes 4-5 hold the number of records and 6-7 the checksum. Each
+// LISTING_METADATA_RECORD_SIZE record is the 16-bit firmware index, the
+// LISTING_METADATA_* flags, the region ('J', 'U', 'E' or 0), the number of
+// tracks, three reserved bytes, the image size in bytes (32-bit little endian)
+// and the game ID from SYSTEM.CNF, NUL padded. Indices the firmware couldn't
+// look up are left out.
+#define LISTING_METADATA_MAGIC1 'M'
+#define LISTING_METADATA_MAX 16
+#define LISTING_METADATA_RECORD_SIZE 24
+#define LISTING_METADATA_GAME_ID_SIZE 12
+
+// Metadata record flags
+#define LISTING_METADATA_PS1 (1 << 0) // First track holds a PlayStation disc
+
+/* Listing State Machine */
+
+typedef enum {
+	LISTING_SM_IDLE          = 0,
+	LISTING_SM_WAIT_FOR_DATA = 1,
+	LISTING_SM_DATA_READY    = 2
+} ListingStateMachineState;
+
+bool doLookup(uint16_t *itemCount, char *sectorBuffer);
+bool doLookupV2(uint16_t *itemCount, char *sectorBuffer);
+bool isListingV2(const char *sectorBuffer);
+uint16_t listing_checksum(const char *sectorBuffer);
+uint16_t listing_decompress(const uint8_t *input, uint16_t inputSize, uint8_t *output, uint16_t decodedSize);
+
+/// @brief Parse consecutive raw 2340-byte listing sectors, stopping at the
+/// first page that says it is the last one.
+/// @return True if the firmware has more entries after these pages.
+bool doLookupSectors(uint16_t *itemCount, uint8_t *sectors, uint8_t numSectors);
+
+/// @brief Select how many listing pages are fetched per request after the
+/// first one. 1 keeps to COMMAND_GET_NEXT_CONTENTS, which every firmware
+/// understands; more needs COMMAND_GET_CONTENTS_BATCH support.
+void listing_setBatchSectors(uint8_t numSectors);
+
+/// @brief Send a directory command and request the first page of its listing.
+/// Any listing still in flight is abandoned.
+/// @param command COMMAND_GOTO_ROOT, COMMAND_GOTO_PARENT or COMMAND_GOTO_DIRECTORY.
+/// @param argument Command argument (directory index for COMMAND_GOTO_DIRECTORY).
+void listing_start(uint8_t command, uint16_t argument);
+
+/// @brief Jump to a directory by path (see IO_COMMAND_GOTO_PATH) and stream
+/// its listing in, in one round trip however deep it is.
+void listing_startPath(const char *path);
+
+/// @brief Send a search query and stream in the firmware's results folder
+/// the same way as listing_start() does for a directory.
+void listing_startSearch(const char *query);
+
+/// @brief Speculatively enter directory `id` and read its first page into a
+/// separate buffer, leaving the current listing alone. The firmware stays in
+/// that directory until listing_startPrefetched() adopts the page or anything
+/// else (listing_start(), listing_cancel(), another prefetch) sends it back
+/// to the parent first.
+void listing_prefetch(uint16_t id);
+bool listing_startPrefetched(uint16_t id);
+
+/// @brief Bring the finished listing up to date with one COMMAND_GET_CHANGES
+/// round trip, inserting added entries in sort order and dropping removed ones.
+/// @return False if the listing has to be loaded again instead (v1 pages, no
+/// generation, firmware asked for a reset or the changes didn't fit).
+bool listing_refresh(uint16_t *count);
+
+/// @brief Generation of the current listing, 0 if unknown. Cached listings
+/// hand theirs back with listing_setGeneration() when they are restored.
+uint16_t listing_getGeneration(void);
+void listing_setGeneration(uint16_t generation);
+
+/// @brief Update the listing state machine. Parses at most one page per call
+/// and requests the next one before doing so, so it can be called once per frame.
+/// @return True on the call that finished the listing (sorted and cleaned).
+bool listing_update(void);
+
+/// @brief Wait for any read in flight and drop the listing being loaded.
+void listing_cancel(void);
+
+/// @brief Blocking version of listing_start() + listing_update().
+/// @return Number of entries in the finished listing.
+uint16_t listing_load(uint8_t command, uint16_t argument);
+
+bool listing_isLoading(void);
+/// @brief True if the entries held so far are already in display order: a
+/// finished listing, or one the firmware collates. v1 pages are only put in
+/// order once the last one is in.
+bool listing_isInOrder(void);
+
+/// @brief Number of entries available so far, including while still loading.
+uint16_t listing_getCount(void);
+
+/// @brief Entry `index` of the current listing. Collated folders with more
+/// than MAX_FILE_ITEMS entries are only held around the cursor; there this
+/// returns NULL for entries that haven't been fetched (yet).
+fileData *listing_getEntry(uint16_t index);
+
+/// @brief Tell the listing where the cursor is, so a windowed folder fetches
+/// the entries around it. listing_update() has to keep being called while
+/// listing_isWindowed(), even once the listing is finished.
+void listing_setCursor(uint16_t index);
+bool listing_isWindowed(void);
+
+/// @brief Start IO_COMMAND_METADATA for up to LISTING_METADATA_MAX entries;
+/// the answer is read into `sector` (LISTING_SECTOR_SIZE bytes). Only done
+/// while the drive is otherwise idle, as loading comes first.
+/// @return False if the request wasn't sent; ask again on a later frame.
+bool listing_requestMetadata(const uint16_t *ids, uint8_t count, uint8_t *sector);
+
+/// @brief Moves the request along without waiting on the drive: sends its
+/// next entry, or starts reading the answer once all are out. True once that
+/// read has landed. Anything else that needs the drive finishes it first.
+bool listing_isMetadataReady(void);
@@ -49,15 +49,20 @@
 #include "psxproject/spu.h"
 #include <stdlib.h>
 #include "file_manager.h"
+#include "listing.h"
+#include "dir_cache.h"
+#include "keyboard.h"
+#include "metadata.h"
+#include "jump_index.h"
+#include "filter.h"
+#include "display_list.h"
+#include "picostation.h"
 #include "counters.h"
 #include "logging.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-#define LISTING_SIZE 2324
-#define MAX_FILES 4096
-
 #if DEBUG_MAIN
 #define DEBUG_PRINT(...) printf(__VA_ARGS__)
 #else
@@ -66,6 +71,7 @@
 
 #define SFX_VOL	10922 // 2/3 of maximal volume
 
+
 // In order to pick sprites (characters) out of our spritesheet, we need a table
 // listing all of them (in ASCII order in this case) with their UV coordinates
 // within the sheet as well as their dimensions. In this example we're going to
@@ -205,38 +211,17 @@ typedef enum
 	MENU_COMMAND_GOTO_DIRECTORY = 0x3,
 	MENU_COMMAND_MOUNT_FILE_FAST = 0x4,
 	MENU_COMMAND_MOUNT_FILE_SLOW = 0x5,
-	MENU_COMMAND_BOOTLOADER = 0x6
+	MENU_COMMAND_BOOTLOADER = 0x6,
+	MENU_COMMAND_REFRESH = 0x7,
+	MENU_COMMAND_SEARCH = 0x8,
+	MENU_COMMAND_OPEN_FOLDER = 0x9
 } MENU_COMMAND;
 
-typedef enum
-{
-	COMMAND_GOTO_ROOT = 0x1,
-	COMMAND_GOTO_PARENT = 0x2,
-	COMMAND_GOTO_DIRECTORY = 0x3,
-	COMMAND_GET_NEXT_CONTENTS = 0x4,
-	COMMAND_MOUNT_FILE = 0x5,
-	COMMAND_IO_COMMAND = 0x6,
-	COMMAND_IO_DATA = 0x7,
-	COMMAND_BOOTLOADER = 0xA
-} COMMAND;
-
-typedef enum
-{
-	IO_COMMAND_NONE = 0x0,
-	IO_COMMAND_GAMEID = 0x1,
-} IO_COMMAND;
-
 #define FONT_FIRST_TABLE_CHAR '!'
 #define FONT_SPACE_WIDTH 4
 #define FONT_TAB_WIDTH 32
 #define FONT_LINE_HEIGHT 10
 
-static void sendCommand(uint8_t command, uint16_t argument)
-{
-	uint8_t test[] = {CDROM_TEST_DSP_CMD, (uint8_t)(0xF0 | command), (uint8_t)((argument >> 8) & 0xFF), (uint8_t)(argument & 0xFF)};
-	issueCDROMCommand(CDROM_CMD_TEST, test, sizeof(test));
-}
-
 static void printString(
 	DMAChain *chain, const TextureInfo *font, int x, int y, const char *str)
 {
@@ -309,6 +294,28 @@ static void printString(
 #define TEXTURE_HEIGHT 20
 #define TEXTURE_COLOR_DEPTH GP0_COLOR_4BPP
 
+// Parts of the screen kept as retained segments in each chain (see
+// display_list.h), one per list row after SEGMENT_ROW. Row text is cut short
+// to fit its segment, well past the edge of the screen.
+enum
+{
+	SEGMENT_BACKGROUND,
+	SEGMENT_HEADER,
+	SEGMENT_METADATA,
+	SEGMENT_FOOTER,
+	SEGMENT_ROW,
+	SEGMENT_ROWS = 16,
+	SEGMENTS = SEGMENT_ROW + SEGMENT_ROWS
+};
+
+#define SEGMENT_WORDS 384
+#define ROW_SEGMENT_WORDS 640
+#define ROW_CHARS ((ROW_SEGMENT_WORDS - 3) / 5) // NUL included
+
+// What printString() needs at most for `str`: the texpage, then a sprite per
+// character.
+#define PRINT_WORDS(str) (2 + 5 * strlen(str))
+
 extern const uint8_t fontTexture[], fontPalette[], logoTexture[], logoPalette[];
 extern const uint8_t click_sfx[], slide_sfx[];
 
@@ -328,48 +335,174 @@ void wait_ms(uint32_t ms)
 	}
 }
 
-bool doLookup(uint16_t *itemCount, char *sectorBuffer)
+// Shows the directory the navigation stack now points at, straight from the
+// cache when possible (only telling the firmware where we went), otherwise by
+// streaming its listing in. Returns the number of entries available right away.
+static uint32_t enterLevel(uint8_t command, uint16_t argument)
 {
-	uint16_t offset = 0;
-	while (offset < LISTING_SIZE && *itemCount < MAX_FILES)
+	uint16_t count;
+	uint16_t generation;
+
+	if (command == COMMAND_GOTO_DIRECTORY && listing_startPrefetched(argument))
 	{
-		uint16_t length = ((uint8_t *)sectorBuffer)[offset];
-		if (length == 0)
+		return 0;
+	}
+
+	listing_cancel();
+	if (dir_cache_restore(dir_cache_get_level()->key, &count, &generation))
+	{
+		listing_setGeneration(generation);
+		sendCommand(command, argument);
+		return count;
+	}
+
+	listing_start(command, argument);
+	return 0;
+}
+
+// Firmware index of entry `index`, 0 if there is none or it isn't loaded.
+static uint16_t entryId(uint16_t index, uint32_t count)
+{
+	fileData *file = index < count ? listing_getEntry(index) : NULL;
+	return file ? file->id : 0;
+}
+
+// Row of the entry named `name`, or with firmware index `id` if the name is
+// empty, among the rows a windowed listing holds on either side of `index`.
+// `count` if it isn't among them.
+static uint32_t findHeldEntry(uint32_t index, uint16_t id, const char *name, uint32_t count)
+{
+	bool up = true;
+	bool down = true;
+	for (uint32_t distance = 0; up || down; distance++)
+	{
+		fileData *below = down && index + distance < count ? listing_getEntry(index + distance) : NULL;
+		fileData *above = up && distance <= index ? listing_getEntry(index - distance) : NULL;
+		if (below && (name[0] ? !strcmp(below->filename, name) : below->id == id))
+		{
+			return index + distance;
+		}
+		if (above && (name[0] ? !strcmp(above->filename, name) : above->id == id))
 		{
-			return sectorBuffer[offset + 1] == 1 || (sectorBuffer[offset + 2] == 0 && sectorBuffer[offset + 3] == 0);
+			return index - distance;
 		}
-		file_manager_init_file_data(*itemCount, sectorBuffer[offset + 1], &sectorBuffer[offset + 2], length);
-		offset += length + 2;
-		*itemCount = *itemCount + 1;
+		down = below != NULL;
+		up = above != NULL;
 	}
 
-	return false;
+	return count;
 }
 
-uint32_t list_load(void *sectorBuffer, uint8_t command, uint16_t argument)
+// Shows the listing in `mode` order, keeping the cursor on the entry it was
+// on. Listings are loaded, patched and cached in name order, and folders too
+// big to hold whole only come in that one, so this waits until they're in.
+static uint16_t showSortMode(fileSortMode mode, uint16_t selected, uint32_t count)
 {
-	uint16_t fileEntryCount = 0;
+	if (listing_isLoading() || listing_isWindowed() || count == 0)
+	{
+		return selected;
+	}
 
-	bool hasNext = true;
-	while (hasNext)
+	uint16_t id = entryId(selected, count);
+	if (!file_manager_set_sort_mode(mode, count))
 	{
-		sendCommand(command, argument);
-		startCDROMRead(
-			100,
-			sectorBuffer,
-			1,
-			2340,
-			true,
-			true);
-
-		hasNext = doLookup(&fileEntryCount, ((char *)sectorBuffer) + 12);
-		command = COMMAND_GET_NEXT_CONTENTS;
-		argument = fileEntryCount;
+		return selected;
 	}
+	jump_index_clear();
+	return file_manager_find_index(id, count);
+}
 
-	file_manager_sort(fileEntryCount);
-	file_manager_clean_list(&fileEntryCount);
-	return fileEntryCount;
+// First row on screen, keeping the cursor in the middle where it can.
+static int32_t firstVisibleRow(int32_t selected, int32_t count, int32_t pageSize)
+{
+	if (count < pageSize)
+	{
+		return 0;
+	}
+	return MIN(MAX(selected - (pageSize / 2), 0), count - pageSize);
+}
+
+// Listing index of row `row` on screen: one of the filter's matches, or the
+// row itself when there is no filter.
+static uint16_t viewIndex(bool filtered, uint16_t row)
+{
+	return filtered ? filter_getIndex(row) : row;
+}
+
+// printString() kept in `segment`, only drawn again when the text or where it
+// goes changes.
+static void printRetained(
+	DMAChain *chain, displaySegment *segment, const TextureInfo *font, int x, int y, const char *str)
+{
+	if (display_list_begin(chain, segment, display_list_key((x << 16) ^ y, str), PRINT_WORDS(str)))
+	{
+		printString(chain, font, x, y, str);
+	}
+	display_list_end(chain, segment);
+}
+
+// Draws `count` rows of the view from `start` down from `y`, with a bar behind
+// `selected` (-1 for none). The text of row i is kept in rows[i], and only
+// formatted again when the entry shown there changes.
+static void drawRows(
+	DMAChain *chain, displaySegment *rows, const TextureInfo *font, bool filtered, int32_t start, int32_t count,
+	int32_t selected, int y, uint8_t highlight
+)
+{
+	for (int32_t i = 0; i < count && i < SEGMENT_ROWS; i++)
+	{
+		uint32_t index = start + i;
+		int rowY = y + (i * 11);
+
+		if (index == selected)
+		{
+			uint8_t color = highlight + 48;
+			uint32_t *ptr = allocatePacket(chain, 3);
+			ptr[0] = gp0_rgb(color, color, color) | gp0_rectangle(false, false, false);
+			ptr[1] = gp0_xy(0, rowY - 2);
+			ptr[2] = gp0_xy(320, 12);
+		}
+
+		fileData *file = listing_getEntry(viewIndex(filtered, index));
+
+		// Row number, folder or file and where on screen, then the name.
+		uint32_t seed = (index << 12) ^ (rowY << 2) ^ (file ? file->flag == 0 : 2);
+		uint32_t key = display_list_key(seed, file ? file->filename : "");
+		if (display_list_begin(chain, &rows[i], key, 2 + 5 * (ROW_CHARS - 1)))
+		{
+			char buffer[ROW_CHARS];
+			if (file)
+			{
+				snprintf(buffer, sizeof(buffer), "%-4d %s %s\n", index + 1, file->flag == 0 ? "\x8f" : "\x92", file->filename);
+			}
+			else
+			{
+				snprintf(buffer, sizeof(buffer), "%-4d ...\n", index + 1);
+			}
+			printString(chain, font, 16, rowY, buffer);
+		}
+		display_list_end(chain, &rows[i]);
+	}
+}
+
+// Same as enterLevel(), but jumps straight to the directory at `path` and
+// rebuilds the navigation stack to match.
+static uint32_t enterPath(const char *path)
+{
+	uint16_t count;
+	uint16_t generation;
+
+	dir_cache_enter_path(path);
+	listing_cancel();
+	if (dir_cache_restore(dir_cache_get_level()->key, &count, &generation))
+	{
+		listing_setGeneration(generation);
+		sendString(IO_COMMAND_GOTO_PATH, path);
+		return count;
+	}
+
+	listing_startPath(path);
+	return 0;
 }
 
 int main(int argc, const char **argv)
@@ -383,6 +516,12 @@ int main(int argc, const char **argv)
 #endif
 	initControllerBus();
 	initCDROM();
+
+	// Use whichever of the faster listing paths the firmware has; firmware
+	// from before the handshake gets single v1 pages and nothing else.
+	negotiateCapabilities(MENU_ACCEPTS_V2 | MENU_ACCEPTS_COMPRESSED | MENU_ACCEPTS_TOTAL);
+	listing_setBatchSectors(getBatchSectors());
+
 	initSPU();
 	
 	MCPpresent = checkMCPpresent();
@@ -433,24 +572,203 @@ int main(int argc, const char **argv)
 	DMAChain dmaChains[2];
 	bool usingSecondFrame = false;
 
-	char sectorBuffer[2324];
-	
+	displaySegment segments[2][SEGMENTS];
+	for (int i = 0; i < 2; i++)
+	{
+		dmaChains[i].limit = &dmaChains[i].data[CHAIN_BUFFER_SIZE];
+		for (int j = 0; j < SEGMENTS; j++)
+		{
+			display_list_reserve(&dmaChains[i], &segments[i][j], j >= SEGMENT_ROW ? ROW_SEGMENT_WORDS : SEGMENT_WORDS);
+		}
+	}
+
 	static uint8_t highlight = 0;
 	
 	uint32_t fileEntryCount = 0;
 
 	uint16_t selectedindex = 0;
 
+	// Firmware index of the entry to put the cursor on once a listing that is
+	// still streaming in has been sorted (the folder we just came back from).
+	uint16_t restoreId = 0;
+	bool restoreSelection = false;
+
+	// Name to look for instead, when the entry's firmware index isn't known.
+	char restoreName[256] = "";
+
+	// A windowed listing is only held around the cursor: it goes to the row
+	// the entry was last seen on, and the entry is looked for once the rows
+	// around it are in, unless the cursor has moved by then.
+	uint16_t restoreIndex = 0;
+	bool restorePending = false;
+
+	// Folder to enter again once its parent is listed, after a refresh the
+	// firmware couldn't patch: the card changed, so the index it was entered
+	// with may point at another folder by now. Nothing else runs meanwhile,
+	// as the firmware isn't in the folder the menu shows.
+	char reenterName[256] = "";
+	uint16_t reenterIndex = 0; // Where it was in a windowed parent
+
 	int creditsmenu = 0;
 
+	// Select cycles through the orders the list can be shown in; holding it
+	// shows the credits instead.
+	fileSortMode sortMode = FILE_SORT_NAME;
+	uint8_t selectFrames = 0;
+
+	// Showing the firmware's search results rather than a folder of the card.
+	// They are never cached, and leaving them puts the cursor back on the
+	// entry it was on when the search started.
+	bool searchView = false;
+	uint16_t searchReturnId = 0;
+	uint16_t searchReturnIndex = 0;
+
+	// Showing only the entries matching what was typed on the keyboard;
+	// selectedindex is then a row of the matches.
+	bool filterView = false;
+
+	// How long the cursor has been on the same entry, for prefetching.
+	uint16_t restingIndex = 0;
+	uint8_t restingFrames = 0;
+
 	uint16_t previousButtons = getButtonPress(0);
 
 	for (;;)
 	{
+		// Pull in at most one listing page per frame, so the list keeps being
+		// drawn and navigated while the rest of a folder streams in behind it.
+		// Folders too big to hold keep fetching around the cursor for good.
+		listing_setCursor(reenterName[0] ? reenterIndex : selectedindex);
+		if (listing_isLoading())
+		{
+			uint16_t selectedFile = entryId(selectedindex, fileEntryCount);
+			bool finished = listing_update();
+
+			fileEntryCount = listing_getCount();
+			if (reenterName[0])
+			{
+				if (finished && listing_isWindowed())
+				{
+					// Only held around the cursor: look for it once the rows
+					// around where it was have arrived.
+					dirLevel child;
+					dir_cache_leave(&child, &reenterIndex);
+					if (reenterIndex >= fileEntryCount)
+					{
+						reenterIndex = fileEntryCount - 1;
+					}
+				}
+				else if (finished)
+				{
+					uint16_t index = fileEntryCount > 0 ? file_manager_find_name(reenterName, fileEntryCount) : 0;
+					fileData *folder = fileEntryCount > 0 ? file_manager_get_file_data(index) : NULL;
+					if (folder && folder->flag == 1 && !strcmp(folder->filename, reenterName))
+					{
+						dirLevel child;
+						uint16_t parentIndex;
+						dir_cache_leave(&child, &parentIndex);
+						dir_cache_enter(folder->id, folder->filename, index);
+						listing_start(COMMAND_GOTO_DIRECTORY, folder->id);
+					}
+					else
+					{
+						// Gone or renamed.
+						dir_cache_reset_path();
+						listing_start(COMMAND_GOTO_ROOT, 0);
+					}
+					reenterName[0] = 0;
+				}
+
+				// The parent's entries aren't for showing.
+				fileEntryCount = 0;
+			}
+			else if (finished && listing_isWindowed())
+			{
+				// Arrived in display order and isn't held whole: nothing to
+				// sort or cache.
+				if (selectedindex == 0 && restoreSelection)
+				{
+					selectedindex = restoreIndex < fileEntryCount ? restoreIndex : 0;
+					restoreIndex = selectedindex;
+					restorePending = true;
+				}
+				restoreSelection = false;
+			}
+			else if (finished)
+			{
+				if (!searchView)
+				{
+					dir_cache_store(dir_cache_get_level()->key, fileEntryCount, listing_getGeneration());
+				}
+
+				// Sorting reorders everything once the last page is in; keep
+				// the cursor on the entry the user had moved to, or else on
+				// the folder we came back from.
+				jump_index_clear();
+				if (selectedindex > 0)
+				{
+					selectedindex = file_manager_find_index(selectedFile, fileEntryCount);
+				}
+				else if (restoreSelection)
+				{
+					selectedindex = restoreName[0] ? file_manager_find_name(restoreName, fileEntryCount) : file_manager_find_index(restoreId, fileEntryCount);
+				}
+				restoreSelection = false;
+				selectedindex = showSortMode(sortMode, selectedindex, fileEntryCount);
+			}
+			if (selectedindex >= fileEntryCount)
+			{
+				selectedindex = fileEntryCount ? fileEntryCount - 1 : 0;
+			}
+		}
+		else if (listing_isWindowed())
+		{
+			listing_update();
+
+			if (reenterName[0] && listing_getEntry(reenterIndex))
+			{
+				uint32_t count = listing_getCount();
+				uint32_t index = findHeldEntry(reenterIndex, 0, reenterName, count);
+				fileData *folder = index < count ? listing_getEntry(index) : NULL;
+				if (folder && folder->flag == 1)
+				{
+					dir_cache_enter(folder->id, folder->filename, index);
+					listing_start(COMMAND_GOTO_DIRECTORY, folder->id);
+					selectedindex = 0;
+				}
+				else
+				{
+					// Gone, or moved out of reach: stay in the parent, where
+					// it used to be.
+					fileEntryCount = count;
+					selectedindex = reenterIndex < count ? reenterIndex : 0;
+				}
+				reenterName[0] = 0;
+			}
+
+			if (restorePending && selectedindex != restoreIndex)
+			{
+				restorePending = false;
+			}
+			else if (restorePending && listing_getEntry(selectedindex))
+			{
+				uint32_t index = findHeldEntry(selectedindex, restoreId, restoreName, fileEntryCount);
+				selectedindex = index < fileEntryCount ? index : selectedindex;
+				restorePending = false;
+			}
+		}
+
+		// Letter groups for L2/R2, extended as rows arrive in display order.
+		if (listing_isInOrder())
+		{
+			jump_index_update(fileEntryCount);
+		}
+
 		int bufferX = usingSecondFrame ? SCREEN_WIDTH : 0;
 		int bufferY = 0;
 
 		DMAChain *chain = &dmaChains[usingSecondFrame];
+		displaySegment *frameSegments = segments[usingSecondFrame];
 		usingSecondFrame = !usingSecondFrame;
 
 		uint32_t *ptr;
@@ -459,36 +777,41 @@ int main(int argc, const char **argv)
 
 		chain->nextPacket = chain->data;
 
-		ptr = allocatePacket(chain, 4);
-		ptr[0] = gp0_texpage(0, true, false);
-		ptr[1] = gp0_fbOffset1(bufferX, bufferY);
-		ptr[2] = gp0_fbOffset2(bufferX + SCREEN_WIDTH - 1, bufferY + SCREEN_HEIGHT - 2);
-		ptr[3] = gp0_fbOrigin(bufferX, bufferY);
-
-		ptr = allocatePacket(chain, 3);
-		ptr[0] = gp0_rgb(27, 25, 47) | gp0_vramFill(); // base fill: bottom color
-		ptr[1] = gp0_xy(bufferX, bufferY);
-		ptr[2] = gp0_xy(SCREEN_WIDTH, SCREEN_HEIGHT);
-
-		ptr = allocatePacket(chain, 8);
-		ptr[0] = gp0_rgb(49, 81, 102) | gp0_shadedQuad(true, false, false); // top-left
-		ptr[1] = gp0_xy(0, 0);
-		ptr[2] = gp0_rgb(49, 81, 102); // top-right same color
-		ptr[3] = gp0_xy(SCREEN_WIDTH, 0);
-		ptr[4] = gp0_rgb(27, 25, 47); // bottom-left
-		ptr[5] = gp0_xy(0, SCREEN_HEIGHT - 1);
-		ptr[6] = gp0_rgb(27, 25, 47); // bottom-right
-		ptr[7] = gp0_xy(SCREEN_WIDTH, SCREEN_HEIGHT - 1);
-
-		//draw logo
-		//if (firstboot == 0 && loadingmenu == 0){
-			ptr    = allocatePacket(chain, 5);
-			ptr[0] = gp0_texpage(logo.page, false, false);
-			ptr[1] = gp0_rectangle(true, true, true);
-			ptr[2] = gp0_xy(96, 10);
-			ptr[3] = gp0_uv(logo.u, logo.v, logo.clut);
-			ptr[4] = gp0_xy(logo.width, logo.height);
-		//}
+		// Everything behind the text only depends on which chain this is.
+		if (display_list_begin(chain, &frameSegments[SEGMENT_BACKGROUND], 1, 24))
+		{
+			ptr = allocatePacket(chain, 4);
+			ptr[0] = gp0_texpage(0, true, false);
+			ptr[1] = gp0_fbOffset1(bufferX, bufferY);
+			ptr[2] = gp0_fbOffset2(bufferX + SCREEN_WIDTH - 1, bufferY + SCREEN_HEIGHT - 2);
+			ptr[3] = gp0_fbOrigin(bufferX, bufferY);
+
+			ptr = allocatePacket(chain, 3);
+			ptr[0] = gp0_rgb(27, 25, 47) | gp0_vramFill(); // base fill: bottom color
+			ptr[1] = gp0_xy(bufferX, bufferY);
+			ptr[2] = gp0_xy(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+			ptr = allocatePacket(chain, 8);
+			ptr[0] = gp0_rgb(49, 81, 102) | gp0_shadedQuad(true, false, false); // top-left
+			ptr[1] = gp0_xy(0, 0);
+			ptr[2] = gp0_rgb(49, 81, 102); // top-right same color
+			ptr[3] = gp0_xy(SCREEN_WIDTH, 0);
+			ptr[4] = gp0_rgb(27, 25, 47); // bottom-left
+			ptr[5] = gp0_xy(0, SCREEN_HEIGHT - 1);
+			ptr[6] = gp0_rgb(27, 25, 47); // bottom-right
+			ptr[7] = gp0_xy(SCREEN_WIDTH, SCREEN_HEIGHT - 1);
+
+			//draw logo
+			//if (firstboot == 0 && loadingmenu == 0){
+				ptr    = allocatePacket(chain, 5);
+				ptr[0] = gp0_texpage(logo.page, false, false);
+				ptr[1] = gp0_rectangle(true, true, true);
+				ptr[2] = gp0_xy(96, 10);
+				ptr[3] = gp0_uv(logo.u, logo.v, logo.clut);
+				ptr[4] = gp0_xy(logo.width, logo.height);
+			//}
+		}
+		display_list_end(chain, &frameSegments[SEGMENT_BACKGROUND]);
 		
 		// get the controller button press
 		uint16_t buttons = getButtonPress(0);
@@ -515,20 +838,120 @@ int main(int argc, const char **argv)
 
 		const uint16_t pageSize = 16;
 
-		if (pressedButtons & BUTTON_MASK_SELECT)
+		bool nextSortMode = false;
+		if (buttons & BUTTON_MASK_SELECT)
 		{
-			creditsmenu = creditsmenu == 0 ? 1 : 0;
+			if (++selectFrames == 45 && !keyboard_isOpen())
+			{
+				creditsmenu = creditsmenu == 0 ? 1 : 0;
+			}
+			selectFrames = MIN(selectFrames, 45);
 		}
+		else
+		{
+			if (selectFrames > 0 && selectFrames < 45 && !keyboard_isOpen())
+			{
+				nextSortMode = creditsmenu == 0;
+				creditsmenu = 0;
+			}
+			selectFrames = 0;
+		}
+
+		if (creditsmenu == 0 && keyboard_isOpen())
+		{
+			// The folder on screen is narrowed down as the user types, if it
+			// is held whole; Start searches the whole card instead.
+			bool canFilter = !listing_isLoading() && !listing_isWindowed();
+			KeyboardResult result = keyboard_update(pressedButtons);
+			if (result == KEYBOARD_SUBMIT && hasCapability(FIRMWARE_CAP_SEARCH))
+			{
+				currentCommand = MENU_COMMAND_SEARCH;
+			}
+			else if ((result == KEYBOARD_SUBMIT || result == KEYBOARD_FILTER) && canFilter && keyboard_getText()[0])
+			{
+				// What was typed while the folder was still loading hasn't
+				// been matched against it yet.
+				filter_set(keyboard_getText(), fileEntryCount);
+				filterView = true;
+				selectedindex = filter_findRow(selectedindex);
+			}
+			else if (result != KEYBOARD_EDITING)
+			{
+				filter_clear();
+			}
+			else if (canFilter)
+			{
+				filter_set(keyboard_getText(), fileEntryCount);
+			}
+			if (pressedButtons)
+			{
+				sound_playOnChannel(&sfx_click, SFX_VOL, SFX_VOL, 0);
+			}
+
+			char qbuffer[KEYBOARD_MAX_LENGTH + 16];
+			snprintf(qbuffer, sizeof(qbuffer), "Search: %s_", keyboard_getText());
+			printRetained(chain, &frameSegments[SEGMENT_HEADER], &font, 40, 40, qbuffer);
 
-		if (creditsmenu == 0)
+			if (canFilter && result == KEYBOARD_EDITING)
+			{
+				snprintf(qbuffer, sizeof(qbuffer), "%i of %i", filter_getCount(), fileEntryCount);
+				printString(chain, &font, 16, 16, qbuffer);
+				drawRows(chain, &frameSegments[SEGMENT_ROW], &font, true, 0, MIN(filter_getCount(), 5), -1, 152, highlight);
+			}
+
+			for (uint8_t row = 0; row < KEYBOARD_ROWS; row++)
+			{
+				for (uint8_t column = 0; column < KEYBOARD_COLUMNS; column++)
+				{
+					int keyX = 40 + (column * 24);
+					int keyY = 70 + (row * 20);
+
+					if (row == keyboard_getRow() && column == keyboard_getColumn())
+					{
+						uint8_t color = highlight + 48;
+						ptr = allocatePacket(chain, 3);
+						ptr[0] = gp0_rgb(color, color, color) | gp0_rectangle(false, false, false);
+						ptr[1] = gp0_xy(keyX - 6, keyY - 4);
+						ptr[2] = gp0_xy(20, 16);
+					}
+
+					char key[2] = {keyboard_getKey(row, column), 0};
+					printString(chain, &font, keyX, keyY, key);
+				}
+			}
+
+			printRetained(chain, &frameSegments[SEGMENT_FOOTER], &font, 12, 212, !canFilter ? "\x91 Type, \x90 Delete, \x96 Search, Circle Cancel"
+				: hasCapability(FIRMWARE_CAP_SEARCH) ? "\x91 Type, \x90 Delete, \x96 Search, Triangle Filter, Circle Cancel"
+				: "\x91 Type, \x90 Delete, Triangle Filter, Circle Cancel");
+
+			highlight = (highlight + 1) & 0x3F;
+		}
+		else if (creditsmenu == 0)
 		{
+			uint32_t viewCount = filterView ? filter_getCount() : fileEntryCount;
+
+			if (nextSortMode && !listing_isWindowed())
+			{
+				// The filter's matches are rows of the old order.
+				if (filterView)
+				{
+					selectedindex = viewCount > 0 ? filter_getIndex(selectedindex) : 0;
+					filterView = false;
+					filter_clear();
+					viewCount = fileEntryCount;
+				}
+				sortMode = (sortMode + 1) % FILE_SORT_MODES;
+				selectedindex = showSortMode(sortMode, selectedindex, fileEntryCount);
+				sound_playOnChannel(&sfx_click, SFX_VOL, SFX_VOL, 0);
+			}
+
 			if (pressedButtons & BUTTON_MASK_UP)
 			{
-				selectedindex = selectedindex > 0 ? selectedindex - 1 : fileEntryCount - 1;
+				selectedindex = selectedindex > 0 ? selectedindex - 1 : viewCount - 1;
 			}
 			else if (pressedButtons & BUTTON_MASK_DOWN)
 			{
-				selectedindex = selectedindex < (int)(fileEntryCount - 1) ? selectedindex + 1 : 0;
+				selectedindex = selectedindex < (int)(viewCount - 1) ? selectedindex + 1 : 0;
 			}
 			
 			if (pressedButtons & (BUTTON_MASK_LEFT | BUTTON_MASK_L1))
@@ -537,38 +960,56 @@ int main(int argc, const char **argv)
 			}
 			else if (pressedButtons & (BUTTON_MASK_RIGHT | BUTTON_MASK_R1))
 			{
-				selectedindex = selectedindex < (int)(fileEntryCount - (pageSize + 1)) ? selectedindex + pageSize : fileEntryCount - 1;
+				selectedindex = selectedindex < (int)(viewCount - (pageSize + 1)) ? selectedindex + pageSize : viewCount - 1;
 			}
+
+			if ((pressedButtons & BUTTON_MASK_L2) && !filterView)
+			{
+				selectedindex = jump_index_previous(selectedindex);
+			}
+			else if ((pressedButtons & BUTTON_MASK_R2) && !filterView)
+			{
+				selectedindex = jump_index_next(selectedindex, fileEntryCount);
+			}
+			uint16_t selectedEntry = viewIndex(filterView, selectedindex);
 			
 			if (pressedButtons & (BUTTON_MASK_UP | BUTTON_MASK_DOWN | BUTTON_MASK_LEFT | BUTTON_MASK_RIGHT 
-																	| BUTTON_MASK_L1   | BUTTON_MASK_R1))
+																	| BUTTON_MASK_L1   | BUTTON_MASK_R1
+																	| BUTTON_MASK_L2   | BUTTON_MASK_R2))
 			{
 				sound_playOnChannel(&sfx_click, SFX_VOL, SFX_VOL, 0);
 			}
 
-			if (pressedButtons & BUTTON_MASK_START)
+			if ((pressedButtons & BUTTON_MASK_START) && viewCount > 0)
 			{
-				fileData *file = file_manager_get_file_data(selectedindex);
-				if (file->flag == 0)
+				fileData *file = listing_getEntry(selectedEntry);
+				if (file && file->flag == 0)
 				{
 					currentCommand = MENU_COMMAND_MOUNT_FILE_SLOW;
 				}
 			}
 
-			if (pressedButtons & BUTTON_MASK_X)
+			if ((pressedButtons & BUTTON_MASK_X) && viewCount > 0)
 			{
-				fileData *file = file_manager_get_file_data(selectedindex);
-				if (file->flag == 0)
+				fileData *file = listing_getEntry(selectedEntry);
+				if (file && file->flag == 0)
 				{
 					currentCommand = MENU_COMMAND_MOUNT_FILE_FAST;
 				}
-				else
+				else if (file && !searchView)
 				{
 					currentCommand = MENU_COMMAND_GOTO_DIRECTORY;
 				}
 			}
 
-			if (pressedButtons & BUTTON_MASK_SQUARE)
+			if ((pressedButtons & BUTTON_MASK_SQUARE) && filterView)
+			{
+				// Back to the whole folder, still on the same entry.
+				selectedindex = viewCount > 0 ? selectedEntry : 0;
+				filterView = false;
+				filter_clear();
+			}
+			else if (pressedButtons & BUTTON_MASK_SQUARE)
 			{
 				currentCommand = MENU_COMMAND_GOTO_PARENT;
 			}
@@ -580,54 +1021,89 @@ int main(int argc, const char **argv)
 
 			if (pressedButtons & BUTTON_MASK_TRIANGLE)
 			{
-				currentCommand = MENU_COMMAND_BOOTLOADER;
+				if (!searchView)
+				{
+					currentCommand = MENU_COMMAND_REFRESH;
+				}
+				else if (viewCount > 0 && listing_getEntry(selectedEntry) && hasCapability(FIRMWARE_CAP_GOTO_PATH))
+				{
+					currentCommand = MENU_COMMAND_OPEN_FOLDER;
+				}
+			}
+
+			if ((pressedButtons & BUTTON_MASK_CIRCLE) &&
+				(hasCapability(FIRMWARE_CAP_SEARCH) || (!listing_isLoading() && !listing_isWindowed())))
+			{
+				// Typing starts over from the whole folder.
+				selectedindex = viewCount > 0 ? selectedEntry : 0;
+				filterView = false;
+				keyboard_open();
 			}
 
-			if (currentCommand != MENU_COMMAND_NONE)
+			// A command runs on the entry the cursor is on in the whole
+			// listing, which it replaces or reorders anyway.
+			if (currentCommand != MENU_COMMAND_NONE && filterView)
+			{
+				selectedindex = viewCount > 0 ? selectedEntry : 0;
+				filterView = false;
+				viewCount = fileEntryCount;
+			}
+
+			if (currentCommand != MENU_COMMAND_NONE || (listing_isLoading() && fileEntryCount == 0))
 			{
 				printString(chain, &font, 40, 40, "Please Wait Loading...");
 			}
 			else
 			{
-				char fbuffer[32];
-				snprintf(fbuffer, sizeof(fbuffer), "%i of %i", selectedindex + 1, fileEntryCount);
-				printString(chain, &font, 16, 16, fbuffer);
+				char fbuffer[32 + KEYBOARD_MAX_LENGTH];
+				int length = snprintf(fbuffer, sizeof(fbuffer), listing_isLoading() ? "%i of %i..." : "%i of %i", selectedindex + 1, viewCount);
+				if (searchView || filterView)
+				{
+					snprintf(fbuffer + length, sizeof(fbuffer) - length, filterView ? "   Filter: %s" : "   Search: %s", keyboard_getText());
+				}
+				else if (file_manager_get_sort_mode() != FILE_SORT_NAME)
+				{
+					snprintf(fbuffer + length, sizeof(fbuffer) - length, "   Sort: %s", file_manager_get_sort_mode() == FILE_SORT_NATURAL ? "Natural" : "No Case");
+				}
+				printRetained(chain, &frameSegments[SEGMENT_HEADER], &font, 16, 16, fbuffer);
 
-				int32_t start = 0;
-				if ((int32_t)fileEntryCount >= pageSize)
+				fileData *selected = viewCount > 0 ? listing_getEntry(viewIndex(filterView, selectedindex)) : NULL;
+				const fileMetadata *metadata = selected && selected->flag == 0 ? metadata_get(selected->id) : NULL;
+				if (metadata && metadata->known)
 				{
-					start = MIN(MAX(selectedindex - (pageSize / 2), 0), (int32_t)fileEntryCount - pageSize);
+					const char *region = metadata->region == 'J' ? "NTSC-J" : metadata->region == 'U' ? "NTSC-U" : metadata->region == 'E' ? "PAL" : "";
+					snprintf(
+						fbuffer, sizeof(fbuffer), "%s\n%s %luM %utr",
+						metadata->gameId[0] ? metadata->gameId : (metadata->flags & LISTING_METADATA_PS1) ? "No ID" : "Audio",
+						region, (unsigned long)(metadata->size >> 20), metadata->tracks);
+					printRetained(chain, &frameSegments[SEGMENT_METADATA], &font, 232, 6, fbuffer);
 				}
 
-				int32_t itemCount = MIN(start + pageSize, (int32_t)fileEntryCount) - start;
+				int32_t start = firstVisibleRow(selectedindex, viewCount, pageSize);
+				int32_t itemCount = MIN(start + pageSize, (int32_t)viewCount) - start;
 				if (itemCount > 0)
 				{
-					for (int32_t i = 0; i < itemCount; i++)
-					{
-						uint32_t index = start + i;
-
-						if (index == selectedindex)
-						{
-							uint8_t color = highlight + 48;
-							ptr = allocatePacket(chain, 3);
-							ptr[0] = gp0_rgb(color, color, color) | gp0_rectangle(false, false, false);
-							ptr[1] = gp0_xy(0, 32 + (i * 11));
-							ptr[2] = gp0_xy(320, 12);
-						}
-
-						fileData *file = file_manager_get_file_data(index);
-
-						char buffer[300];
-						snprintf(buffer, sizeof(buffer), "%-4d %s %s\n", index + 1, file->flag == 0 ? "\x8f" : "\x92", file->filename);
-						printString(chain, &font, 16, 34 + (i * 11), buffer);
-					}
+					drawRows(chain, &frameSegments[SEGMENT_ROW], &font, filterView, start, itemCount, selectedindex, 34, highlight);
 				}
 				else
 				{
-					printString(chain, &font, 40, 40, "Empty Folder");
+					printString(chain, &font, 40, 40, searchView || filterView ? "No matches" : "Empty Folder");
 				}
 
-				printString(chain, &font, 12, 212, "\x91 Select / Fast Boot, \x96 Regular Boot, \x90 Parent Folder");
+				if (filterView)
+				{
+					printRetained(chain, &frameSegments[SEGMENT_FOOTER], &font, 12, 212, "\x91 Select / Fast Boot, \x96 Regular Boot, \x90 Whole Folder");
+				}
+				else if (searchView)
+				{
+					printRetained(chain, &frameSegments[SEGMENT_FOOTER], &font, 12, 212, hasCapability(FIRMWARE_CAP_GOTO_PATH)
+						? "\x91 Fast Boot, \x96 Regular Boot, \x90 Back, Triangle Open Folder"
+						: "\x91 Fast Boot, \x96 Regular Boot, \x90 Back");
+				}
+				else
+				{
+					printRetained(chain, &frameSegments[SEGMENT_FOOTER], &font, 12, 212, "\x91 Select / Fast Boot, \x96 Regular Boot, \x90 Parent Folder");
+				}
 				
 				highlight = (highlight + 1) & 0x3F;
 			}
@@ -653,16 +1129,167 @@ int main(int argc, const char **argv)
 		waitForVblank();
 		sendLinkedList(chain->data);
 
+		if (reenterName[0])
+		{
+			currentCommand = MENU_COMMAND_NONE;
+		}
+
 		if (currentCommand != MENU_COMMAND_NONE)
 		{
+			restorePending = false;
+
+			// Commands work on name order: it's the one cached, and the one
+			// saved cursor positions refer to.
+			selectedindex = showSortMode(FILE_SORT_NAME, selectedindex, fileEntryCount);
+
 			if (currentCommand == MENU_COMMAND_GOTO_ROOT)
 			{
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_ROOT, 0);
+				dir_cache_reset_path();
+				fileEntryCount = enterLevel(COMMAND_GOTO_ROOT, 0);
+				selectedindex = 0;
+				restoreSelection = false;
+			}
+			else if (currentCommand == MENU_COMMAND_GOTO_PARENT && searchView)
+			{
+				// The firmware goes back to the folder the search started
+				// from, which is still the current level here.
+				searchView = false;
+				restoreId = searchReturnId;
+				restoreIndex = searchReturnIndex;
+				restoreName[0] = 0;
+
+				fileEntryCount = enterLevel(COMMAND_GOTO_PARENT, 0);
+				restoreSelection = fileEntryCount == 0;
+				selectedindex = fileEntryCount > 0 ? file_manager_find_index(restoreId, fileEntryCount) : 0;
+			}
+			else if (currentCommand == MENU_COMMAND_SEARCH)
+			{
+				if (!searchView)
+				{
+					searchReturnId = entryId(selectedindex, fileEntryCount);
+					searchReturnIndex = selectedindex;
+					searchView = true;
+				}
+
+				listing_startSearch(keyboard_getText());
+				fileEntryCount = 0;
+				selectedindex = 0;
+				restoreSelection = false;
+			}
+			else if (currentCommand == MENU_COMMAND_OPEN_FOLDER)
+			{
+				// Results carry the path they were found under: jump to that
+				// folder in one go and put the cursor on the file.
+				char folder[DIR_CACHE_PATH_SIZE];
+				fileData *file = listing_getEntry(selectedindex);
+				snprintf(folder, sizeof(folder), "%s", file->filename);
+
+				char *name = strrchr(folder, '/');
+				snprintf(restoreName, sizeof(restoreName), "%s", name ? name + 1 : folder);
+				*(name ? name : folder) = 0;
+				restoreIndex = 0;
+
+				searchView = false;
+				fileEntryCount = enterPath(folder);
+				restoreSelection = fileEntryCount == 0;
+				selectedindex = fileEntryCount > 0 ? file_manager_find_name(restoreName, fileEntryCount) : 0;
 			}
 			else if (currentCommand == MENU_COMMAND_GOTO_PARENT)
 			{
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_PARENT, 0);
+				dirLevel child;
+				uint16_t parentIndex;
+
+				// A level jumped to by path has no firmware index to look for
+				// in its parent, so look for its name.
+				const char *path = dir_cache_get_path();
+				restoreName[0] = 0;
+				if (dir_cache_get_level()->id == DIR_CACHE_ID_UNKNOWN && path)
+				{
+					const char *name = strrchr(path, '/');
+					snprintf(restoreName, sizeof(restoreName), "%s", name ? name + 1 : path);
+				}
+
 				selectedindex = 0;
+				restoreSelection = dir_cache_leave(&child, &parentIndex);
+				restoreId = child.id;
+				restoreIndex = parentIndex;
+
+				fileEntryCount = enterLevel(COMMAND_GOTO_PARENT, 0);
+				if (restoreSelection && fileEntryCount > 0)
+				{
+					// Served from the cache: the saved cursor position refers to
+					// exactly this listing.
+					if (restoreName[0])
+					{
+						selectedindex = file_manager_find_name(restoreName, fileEntryCount);
+					}
+					else
+					{
+						selectedindex = parentIndex < fileEntryCount ? parentIndex : 0;
+					}
+					restoreSelection = false;
+				}
+			}
+			else if (currentCommand == MENU_COMMAND_REFRESH)
+			{
+				restoreSelection = fileEntryCount > 0;
+				restoreId = entryId(selectedindex, fileEntryCount);
+				restoreIndex = selectedindex;
+				restoreName[0] = 0;
+
+				// Ask the firmware what changed since this listing was taken
+				// and patch it. The patched listing goes back into the cache,
+				// and the entries are pointed at that copy.
+				uint32_t key = dir_cache_get_level()->key;
+				uint16_t count = fileEntryCount;
+				uint16_t generation;
+				bool refreshed = hasCapability(FIRMWARE_CAP_CHANGES) && listing_refresh(&count);
+				if (refreshed)
+				{
+					dir_cache_store(key, count, listing_getGeneration());
+					refreshed = dir_cache_restore(key, &count, &generation);
+				}
+
+				if (refreshed)
+				{
+					// Anything else on the card may have changed too.
+					dir_cache_retain(key);
+					fileEntryCount = count;
+					selectedindex = restoreSelection ? file_manager_find_index(restoreId, fileEntryCount) : 0;
+					restoreSelection = false;
+				}
+				else
+				{
+					// No way to patch it; drop every cached listing and list
+					// this folder again.
+					dir_cache_clear();
+					listing_cancel();
+
+					// There is no "list again" command; jump back in by path,
+					// or else step out and look the folder up again by name.
+					const char *path = dir_cache_get_path();
+					if (dir_cache_get_depth() == 0)
+					{
+						listing_start(COMMAND_GOTO_ROOT, 0);
+					}
+					else if (path && hasCapability(FIRMWARE_CAP_GOTO_PATH))
+					{
+						listing_startPath(path);
+					}
+					else if (path)
+					{
+						const char *name = strrchr(path, '/');
+						snprintf(reenterName, sizeof(reenterName), "%s", name ? name + 1 : path);
+						listing_start(COMMAND_GOTO_PARENT, 0);
+					}
+					else
+					{
+						dir_cache_reset_path();
+						listing_start(COMMAND_GOTO_ROOT, 0);
+					}
+					fileEntryCount = 0;
+					selectedindex = 0;
+				}
 			}
 			else if (currentCommand == MENU_COMMAND_BOOTLOADER)
 			{
@@ -670,23 +1297,39 @@ int main(int argc, const char **argv)
 			}
 			else if (currentCommand == MENU_COMMAND_GOTO_DIRECTORY)
 			{
-				uint16_t index = file_manager_get_file_index(selectedindex);
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_DIRECTORY, index);
+				fileData *file = listing_getEntry(selectedindex);
+				uint16_t index = file->id;
+
+				dir_cache_enter(index, file->filename, selectedindex);
+				fileEntryCount = enterLevel(COMMAND_GOTO_DIRECTORY, index);
 				selectedindex = 0;
+				restoreSelection = false;
 			}
 			else if ((currentCommand == MENU_COMMAND_MOUNT_FILE_FAST) || (currentCommand == MENU_COMMAND_MOUNT_FILE_SLOW))
 			{
 				DEBUG_PRINT("DEBUG: selectedindex :%d\n", selectedindex);
 
-				uint16_t index = file_manager_get_file_index(selectedindex);
+				uint16_t index = entryId(selectedindex, fileEntryCount);
+				const fileMetadata *metadata = metadata_get(index);
+				bool mountInfo = hasCapability(FIRMWARE_CAP_MOUNT_INFO) && metadata && metadata->known;
+				listing_cancel();
+
 				DEBUG_PRINT("Mount image\n");
 				sendCommand(COMMAND_MOUNT_FILE, index);
-				delayMicroseconds(400000);
+				if (hasCapability(FIRMWARE_CAP_MOUNT_INFO))
+				{
+					// Acknowledged once the image is in place.
+					waitForINT3();
+				}
+				else
+				{
+					delayMicroseconds(400000);
+				}
 				DEBUG_PRINT("Update TOC\n");
 				updateCDROM_TOC();
 				delayMicroseconds(400000);
 				DEBUG_PRINT("Check CD type\n");
-				if (is_playstation_cd())
+				if (mountInfo ? (metadata->flags & LISTING_METADATA_PS1) : is_playstation_cd())
 				{
 					DEBUG_PRINT("is PS1 image\n");
 					if (MCPpresent && !initFilesystem())
@@ -760,6 +1403,49 @@ int main(int argc, const char **argv)
 			}
 
 			currentCommand = MENU_COMMAND_NONE;
+			metadata_clear();
+			jump_index_clear();
+			filter_clear();
+			selectedindex = showSortMode(sortMode, selectedindex, fileEntryCount);
+		}
+
+		uint32_t viewCount = filterView ? filter_getCount() : fileEntryCount;
+		if (selectedindex != restingIndex || creditsmenu != 0 || searchView || listing_isLoading())
+		{
+			restingIndex = selectedindex;
+			restingFrames = 0;
+		}
+		else if (restingFrames < PREFETCH_DELAY_FRAMES && ++restingFrames == PREFETCH_DELAY_FRAMES)
+		{
+			// Resting on a folder that isn't cached: start reading it now so
+			// X has its first page ready. Moving on just leaves it unused.
+			fileData *file = selectedindex < viewCount ? listing_getEntry(viewIndex(filterView, selectedindex)) : NULL;
+			if (file && file->flag == 1 && !dir_cache_has_child(file->filename))
+			{
+				listing_prefetch(file->id);
+			}
+		}
+
+		// Details of the files on screen, asked for in the time left after the
+		// frame went out. Resting on a folder leaves the drive to its prefetch.
+		fileData *resting = selectedindex < viewCount ? listing_getEntry(viewIndex(filterView, selectedindex)) : NULL;
+		if (creditsmenu == 0 && !keyboard_isOpen() && !listing_isLoading() && hasCapability(FIRMWARE_CAP_METADATA) &&
+			!(restingFrames == PREFETCH_DELAY_FRAMES && resting && resting->flag == 1))
+		{
+			uint16_t ids[LISTING_METADATA_MAX];
+			uint8_t count = 0;
+
+			int32_t start = firstVisibleRow(selectedindex, viewCount, pageSize);
+			for (int32_t index = start; index < MIN(start + pageSize, (int32_t)viewCount); index++)
+			{
+				fileData *file = listing_getEntry(viewIndex(filterView, index));
+				if (file && file->flag == 0 && count < LISTING_METADATA_MAX)
+				{
+					ids[count++] = file->id;
+				}
+			}
+
+			metadata_update(ids, count);
 		}
 	}
 
@@ -0,0 +1,150 @@
+#include "metadata.h"
+
+#include <string.h>
+
+// Searched in full: it is small, and unlike hashing by index, rows on screen
+// can never push each other out. The oldest entry makes room for a new one.
+static fileMetadata metadataCache[METADATA_CACHE_SIZE];
+static uint8_t metadataCached;
+static uint8_t metadataOldest;
+
+static uint8_t metadataSector[LISTING_SECTOR_SIZE] __attribute__((aligned(4)));
+static uint16_t metadataPendingIds[LISTING_METADATA_MAX];
+static uint8_t metadataPendingCount;
+static bool metadataPending;
+static uint8_t metadataRetries;
+
+void metadata_clear(void)
+{
+	// An answer still on its way belongs to the folder being left.
+	metadataPending = false;
+	metadataRetries = 0;
+	metadataCached = 0;
+	metadataOldest = 0;
+}
+
+static fileMetadata *findCached(uint16_t id)
+{
+	for (uint8_t i = 0; i < metadataCached; i++)
+	{
+		if (metadataCache[i].id == id)
+		{
+			return &metadataCache[i];
+		}
+	}
+
+	return NULL;
+}
+
+const fileMetadata *metadata_get(uint16_t id)
+{
+	return findCached(id);
+}
+
+static fileMetadata *store(uint16_t id)
+{
+	fileMetadata *data = findCached(id);
+	if (!data)
+	{
+		if (metadataCached < METADATA_CACHE_SIZE)
+		{
+			data = &metadataCache[metadataCached++];
+		}
+		else
+		{
+			data = &metadataCache[metadataOldest];
+			metadataOldest = (metadataOldest + 1) % METADATA_CACHE_SIZE;
+		}
+	}
+
+	memset(data, 0, sizeof(*data));
+	data->id = id;
+	return data;
+}
+
+// Files the firmware left out of its answer are cached as unknown so they
+// aren't asked for again.
+static void storeAnswer(void)
+{
+	for (uint8_t i = 0; i < metadataPendingCount; i++)
+	{
+		store(metadataPendingIds[i]);
+	}
+
+	const uint8_t *page = &metadataSector[LISTING_HEADER_SIZE];
+	uint16_t count = page[4] | (page[5] << 8);
+	if (count > LISTING_METADATA_MAX)
+	{
+		count = LISTING_METADATA_MAX;
+	}
+
+	const uint8_t *record = &page[LISTING_V2_HEADER_SIZE];
+	for (uint16_t i = 0; i < count; i++, record += LISTING_METADATA_RECORD_SIZE)
+	{
+		fileMetadata *data = store(record[0] | (record[1] << 8));
+		data->known = true;
+		data->flags = record[2];
+		data->region = (char)record[3];
+		data->tracks = record[4];
+		data->size = record[8] | (record[9] << 8) | (record[10] << 16) | ((uint32_t)record[11] << 24);
+		memcpy(data->gameId, &record[12], LISTING_METADATA_GAME_ID_SIZE);
+		data->gameId[LISTING_METADATA_GAME_ID_SIZE] = 0;
+	}
+}
+
+static void receiveAnswer(void)
+{
+	const uint8_t *page = &metadataSector[LISTING_HEADER_SIZE];
+
+	// A damaged answer is asked for again by the next call, until the files
+	// are given up on and shown without details.
+	uint16_t checksum = page[6] | (page[7] << 8);
+	bool intact = page[0] == LISTING_V2_MAGIC0 && page[1] == LISTING_METADATA_MAGIC1 &&
+		page[2] == LISTING_V2_VERSION && checksum == listing_checksum((const char *)page);
+	if (!intact && ++metadataRetries < LISTING_MAX_RETRIES)
+	{
+		return;
+	}
+
+	metadataRetries = 0;
+	if (intact)
+	{
+		storeAnswer();
+	}
+	else
+	{
+		for (uint8_t i = 0; i < metadataPendingCount; i++)
+		{
+			store(metadataPendingIds[i]);
+		}
+	}
+}
+
+void metadata_update(const uint16_t *ids, uint8_t count)
+{
+	if (metadataPending)
+	{
+		if (!listing_isMetadataReady())
+		{
+			return;
+		}
+		metadataPending = false;
+		receiveAnswer();
+		return;
+	}
+
+	uint8_t missing = 0;
+	for (uint8_t i = 0; i < count && missing < LISTING_METADATA_MAX; i++)
+	{
+		if (!metadata_get(ids[i]))
+		{
+			metadataPendingIds[missing++] = ids[i];
+		}
+	}
+
+	if (missing && listing_requestMetadata(metadataPendingIds, missing, metadataSector))
+	{
+		metadataPendingCount = missing;
+		metadataPending = true;
+	}
+}
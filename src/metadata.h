@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "listing.h"
+
+// Size, track count, game ID and region of the images in the current folder,
+// from firmware with FIRMWARE_CAP_METADATA. They are only asked for the rows
+// on screen, a few at a time whenever the drive has nothing else to do, and
+// kept by firmware index until the folder changes.
+#define METADATA_CACHE_SIZE 128
+
+typedef struct
+{
+	uint16_t id;
+	bool known;     // False if the firmware couldn't look the image up
+	uint8_t flags;  // LISTING_METADATA_*
+	char region;    // 'J', 'U', 'E' or 0
+	uint8_t tracks;
+	uint32_t size;  // Bytes
+	char gameId[LISTING_METADATA_GAME_ID_SIZE + 1];
+} fileMetadata;
+
+/// @brief Forget everything; call whenever the folder on screen changes.
+void metadata_clear(void);
+
+/// @brief Cached details of entry `id`, NULL if they haven't arrived (yet).
+const fileMetadata *metadata_get(uint16_t id);
+
+/// @brief Fetch whatever is missing for `ids`, the files on screen. Never
+/// waits: each call moves the request under way along by one step, picks up
+/// its answer or sends a new one, and does nothing while the listing needs
+/// the drive.
+void metadata_update(const uint16_t *ids, uint8_t count);
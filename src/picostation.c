@@ -0,0 +1,68 @@
+#include "picostation.h"
+#include "ps1/cdrom.h"
+#include "psxproject/cdrom.h"
+
+static uint16_t firmwareCapabilities;
+static uint8_t firmwareBatchSectors = 1;
+
+void sendCommand(uint8_t command, uint16_t argument)
+{
+	uint8_t test[] = {CDROM_TEST_DSP_CMD, (uint8_t)(0xF0 | command), (uint8_t)((argument >> 8) & 0xFF), (uint8_t)(argument & 0xFF)};
+	issueCDROMCommand(CDROM_CMD_TEST, test, sizeof(test));
+}
+
+// Starts an IO_COMMAND_* and streams its NUL-terminated string argument after
+// it, two characters per COMMAND_IO_DATA word with the first one in the high
+// byte. The word holding the terminator ends the string.
+void sendString(uint8_t ioCommand, const char *text)
+{
+	sendCommand(COMMAND_IO_COMMAND, ioCommand);
+	waitForINT3();
+
+	for (uint32_t i = 0;; i += 2)
+	{
+		uint16_t pair = (uint8_t)text[i] << 8;
+		if (text[i] != 0)
+		{
+			pair |= (uint8_t)text[i + 1];
+		}
+
+		sendCommand(COMMAND_IO_DATA, pair);
+		waitForINT3();
+
+		if (text[i] == 0 || text[i + 1] == 0)
+		{
+			break;
+		}
+	}
+}
+
+void negotiateCapabilities(uint16_t menuAccepts)
+{
+	sendCommand(COMMAND_GET_CAPABILITIES, menuAccepts);
+	waitForINT3();
+
+	firmwareCapabilities = 0;
+	firmwareBatchSectors = 1;
+	if (cdromRespLength < CAPABILITIES_RESPONSE_LENGTH ||
+		cdromResponse[1] != CAPABILITIES_MAGIC0 || cdromResponse[2] != CAPABILITIES_MAGIC1)
+	{
+		return;
+	}
+
+	firmwareCapabilities = cdromResponse[3] | (cdromResponse[4] << 8);
+	if ((firmwareCapabilities & FIRMWARE_CAP_BATCH) && cdromResponse[5] > 1)
+	{
+		firmwareBatchSectors = cdromResponse[5];
+	}
+}
+
+bool hasCapability(uint16_t capabilities)
+{
+	return (firmwareCapabilities & capabilities) == capabilities;
+}
+
+uint8_t getBatchSectors(void)
+{
+	return firmwareBatchSectors;
+}
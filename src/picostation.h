@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Commands understood by the picostation firmware. They are smuggled to it
+// through CDROM_CMD_TEST / CDROM_TEST_DSP_CMD, so each one carries a 4-bit
+// command and a 16-bit argument.
+typedef enum
+{
+	COMMAND_GOTO_ROOT = 0x1,
+	COMMAND_GOTO_PARENT = 0x2,
+	COMMAND_GOTO_DIRECTORY = 0x3,
+	COMMAND_GET_NEXT_CONTENTS = 0x4,
+	COMMAND_MOUNT_FILE = 0x5,
+	COMMAND_IO_COMMAND = 0x6,
+	COMMAND_IO_DATA = 0x7,
+	// Same as COMMAND_GET_NEXT_CONTENTS, but the firmware lays out the next
+	// (argument >> 12) + 1 pages in consecutive sectors from LBA 100 so they
+	// can be read in one go. The low 12 bits are the first entry to send.
+	COMMAND_GET_CONTENTS_BATCH = 0x8,
+	COMMAND_BOOTLOADER = 0xA,
+	// Entries added to or removed from the current directory since the
+	// generation in the argument, see LISTING_CHANGES_RESET in listing.h.
+	COMMAND_GET_CHANGES = 0xC,
+	// Handshake sent once at startup, see negotiateCapabilities(). The
+	// argument holds the MENU_ACCEPTS_* flags.
+	COMMAND_GET_CAPABILITIES = 0xD
+} COMMAND;
+
+// What the menu can parse, so the firmware only uses page formats it knows
+// the menu understands.
+#define MENU_ACCEPTS_V2         (1 << 0) // Collated and checked v2 pages, "PD" and "PM" pages
+#define MENU_ACCEPTS_COMPRESSED (1 << 1) // LISTING_PAGE_COMPRESSED pages
+#define MENU_ACCEPTS_TOTAL      (1 << 2) // LISTING_PAGE_TOTAL pages
+
+// Firmware that knows COMMAND_GET_CAPABILITIES answers it with the response
+// bytes 'P', 'C', its FIRMWARE_CAP_* flags (16-bit little endian) and the most
+// sectors it lays out for COMMAND_GET_CONTENTS_BATCH. Older firmware only
+// returns the drive status, which leaves every flag clear.
+#define CAPABILITIES_MAGIC0 'P'
+#define CAPABILITIES_MAGIC1 'C'
+#define CAPABILITIES_RESPONSE_LENGTH 6
+
+#define FIRMWARE_CAP_BATCH      (1 << 0) // COMMAND_GET_CONTENTS_BATCH
+#define FIRMWARE_CAP_V2         (1 << 1) // Collated v2 pages
+#define FIRMWARE_CAP_COMPRESSED (1 << 2) // Compressed v2 pages
+#define FIRMWARE_CAP_CHANGES    (1 << 3) // COMMAND_GET_CHANGES
+#define FIRMWARE_CAP_SEARCH     (1 << 4) // IO_COMMAND_SEARCH
+#define FIRMWARE_CAP_GOTO_PATH  (1 << 5) // IO_COMMAND_GOTO_PATH
+#define FIRMWARE_CAP_METADATA   (1 << 6) // IO_COMMAND_METADATA
+// COMMAND_MOUNT_FILE is only acknowledged once the image is mounted, and the
+// flags of its IO_COMMAND_METADATA record can stand in for probing the disc.
+#define FIRMWARE_CAP_MOUNT_INFO (1 << 7)
+
+// Sub-commands sent with COMMAND_IO_COMMAND. Those that take a string get it
+// through sendString(); IO_COMMAND_METADATA sends its words itself, one per
+// frame, see listing_requestMetadata().
+typedef enum
+{
+	IO_COMMAND_NONE = 0x0,
+	IO_COMMAND_GAMEID = 0x1,
+	// Search the whole card for images whose name contains the string (case
+	// insensitive). The firmware shows the matches as a folder of its own,
+	// listed from entry 0 with COMMAND_GET_NEXT_CONTENTS like any other, and
+	// COMMAND_GOTO_PARENT leaves it for the folder the search started from.
+	// Names may carry the path of the folder they were found in.
+	IO_COMMAND_SEARCH = 0x2,
+	// Go straight to the folder at a '/'-separated path from the root ("" is
+	// the root itself), leaving the search results if they are shown. A
+	// missing component stops it at the deepest folder that exists. Its
+	// listing is then read from entry 0 with COMMAND_GET_NEXT_CONTENTS.
+	IO_COMMAND_GOTO_PATH = 0x3,
+	// Look up the size, track count, game ID and region of some images in the
+	// current folder, given as their firmware indices and ended by 0xFFFF. The
+	// answer is a single metadata page (see listing.h) at the listing LBA.
+	IO_COMMAND_METADATA = 0x4,
+} IO_COMMAND;
+
+void sendCommand(uint8_t command, uint16_t argument);
+void sendString(uint8_t ioCommand, const char *text);
+
+/// @brief Tell the firmware which page formats the menu takes and learn what
+/// it supports. Call once, right after initCDROM().
+void negotiateCapabilities(uint16_t menuAccepts);
+
+/// @brief True if the firmware reported all of the FIRMWARE_CAP_* flags given.
+bool hasCapability(uint16_t capabilities);
+
+/// @brief Most sectors the firmware batches per request, 1 without FIRMWARE_CAP_BATCH.
+uint8_t getBatchSectors(void);
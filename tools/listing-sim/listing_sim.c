@@ -0,0 +1,1263 @@
+// Runs the menu's listing code (listing.c, file_manager.c) against a host-side
+// picostation firmware model.
+//
+//   listing-sim list <dir> [--cd <name>]... [options]
+//       Print a real directory tree's listing the way the menu would show it.
+//   listing-sim bench [options]
+//       Time-to-first-entry and full listing cost for synthetic folders.
+//   listing-sim refresh [options]
+//       Cost of a refresh through COMMAND_GET_CHANGES with and without
+//       changes, checked against listing the folder again (implies --v2).
+//   listing-sim scroll [options]
+//       Page through folders too big to hold whole, top to bottom and back,
+//       checking every row against the firmware (implies --v2).
+//   listing-sim sort
+//       CPU cycles file_manager_sort() and file_manager_clean_list() take on
+//       synthetic folders, next to the code they replaced, checking both
+//       agree on the result.
+//   listing-sim check
+//       Sorting, bin/cue cleanup and page parsing on small hand-made
+//       listings, including the empty and single-entry edge cases.
+//   listing-sim filter
+//       CPU cycles each keystroke of a type-to-filter takes on a folder of
+//       MAX_FILE_ITEMS names, refining the matches or starting over, checked
+//       against a plain search of every name.
+//
+// Options:
+//   --v2            Firmware answers with pre-collated v2 pages
+//   --compress      Same, with front-coded and LZSS packed pages
+//   --no-total      Leave the folder size off v2 pages, so folders too big
+//                   to hold are counted as they are read
+//   --batch <K>     Fetch K listing sectors per request after the first,
+//                   instead of as many as the firmware offers
+//   --no-vsync      Don't limit the menu to one listing_update() per frame
+//   --cpu-scale <X> Multiply host CPU time by X to approximate the R3000
+//   --corrupt-every <N> Damage every Nth listing sector the firmware sends
+//   --prefetch      (list) Rest on each --cd folder long enough for the menu
+//                   to prefetch it before entering
+//   --path <path>   (list) Jump to a folder by path after the --cd folders
+//   --search <text> (list) Search from the last --cd folder and print the
+//                   results, then leave them and check the folder comes back
+//   --metadata      (list) Fetch size, tracks and game ID a screen of rows at
+//                   a time as main() does and print them with the listing
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "dir_cache.h"
+#include "file_manager.h"
+#include "filter.h"
+#include "listing.h"
+#include "metadata.h"
+#include "picostation.h"
+#include "sim_cdrom.h"
+#include "sim_firmware.h"
+
+#define FRAME_US (1000000.0 / 60.0)
+#define MAX_CD_NAMES 16
+
+typedef struct
+{
+	bool vsync;
+	uint8_t batch;
+	uint32_t corruptEvery;
+	bool compress;
+	bool prefetch;
+	const char *path;
+	const char *search;
+	bool metadata;
+	bool noTotal;
+} benchOptions;
+
+typedef struct
+{
+	uint16_t count;
+	double firstEntryUs;
+	double totalUs;
+	double cpuUs;
+	double lastUs; // CPU time of the update that finished the listing
+} listingResult;
+
+// Host time spent in the menu code since `start`, leaving out whatever the
+// firmware model did on its behalf.
+static double menu_cpu_since(double start, double firmwareStart)
+{
+	return (sim_host_us() - start) - (simCounters.firmwareHostUs - firmwareStart);
+}
+
+// Drives the listing state machine the way main() does: one update per frame.
+// With a `text`, `argument` is IO_COMMAND_SEARCH or IO_COMMAND_GOTO_PATH.
+static listingResult run_listing(const benchOptions *options, uint8_t command, uint16_t argument, const char *text)
+{
+	listingResult result = {0};
+	double start = sim_now();
+
+	double t = sim_host_us();
+	double fw = simCounters.firmwareHostUs;
+	if (text && argument == IO_COMMAND_GOTO_PATH)
+	{
+		listing_startPath(text);
+	}
+	else if (text)
+	{
+		listing_startSearch(text);
+	}
+	else if (command != COMMAND_GOTO_DIRECTORY || !listing_startPrefetched(argument))
+	{
+		listing_start(command, argument);
+	}
+	double cpu = menu_cpu_since(t, fw);
+	result.cpuUs += cpu;
+	sim_advance(cpu * simTimingModel.cpuScale);
+
+	while (listing_isLoading())
+	{
+		t = sim_host_us();
+		fw = simCounters.firmwareHostUs;
+		bool finished = listing_update();
+		cpu = menu_cpu_since(t, fw);
+		result.cpuUs += cpu;
+		sim_advance(cpu * simTimingModel.cpuScale);
+
+		if (!result.firstEntryUs && listing_getCount() > 0)
+		{
+			result.firstEntryUs = sim_now() - start;
+		}
+		if (finished)
+		{
+			result.lastUs = cpu;
+			break;
+		}
+
+		if (options->vsync)
+		{
+			double frames = (double)(long)(sim_now() / FRAME_US) + 1;
+			sim_advance_to(frames * FRAME_US);
+		}
+		else
+		{
+			sim_wait_for_drive();
+		}
+	}
+
+	result.count = listing_getCount();
+	result.totalUs = sim_now() - start;
+	return result;
+}
+
+// Starts the firmware model and runs the startup handshake the way main()
+// does, before the counters are reset.
+static void start_firmware(const benchOptions *options, const simFirmwareConfig *config)
+{
+	sim_firmware_init(config);
+	negotiateCapabilities(MENU_ACCEPTS_V2 | MENU_ACCEPTS_COMPRESSED | MENU_ACCEPTS_TOTAL);
+	listing_setBatchSectors(options->batch ? options->batch : getBatchSectors());
+	sim_reset();
+}
+
+static void print_capabilities(void)
+{
+	static const struct
+	{
+		uint16_t flag;
+		const char *name;
+	} names[] = {
+		{FIRMWARE_CAP_BATCH, "batch"}, {FIRMWARE_CAP_V2, "v2"}, {FIRMWARE_CAP_COMPRESSED, "compressed"},
+		{FIRMWARE_CAP_CHANGES, "changes"}, {FIRMWARE_CAP_SEARCH, "search"}, {FIRMWARE_CAP_GOTO_PATH, "path"},
+		{FIRMWARE_CAP_METADATA, "metadata"}, {FIRMWARE_CAP_MOUNT_INFO, "mount-info"},
+	};
+
+	printf("firmware:");
+	bool any = false;
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (hasCapability(names[i].flag))
+		{
+			printf(" %s", names[i].name);
+			any = true;
+		}
+	}
+	printf(any ? ", up to %u sectors a request\n" : " no handshake, %u sector a request\n", getBatchSectors());
+}
+
+static const char *batch_name(const benchOptions *options)
+{
+	static char name[16];
+	if (!options->batch)
+	{
+		return "negotiated";
+	}
+	snprintf(name, sizeof(name), "%u", options->batch);
+	return name;
+}
+
+// file_manager.c's working arrays, for checking and timing its sort.
+extern uint16_t *fileIndexBuffer;
+extern fileData *fileDataBuffer;
+
+// The order file_manager_sort() puts entries in, as the recursive quicksort
+// it replaced compared them (that quicksort is further down, for `sort`), but
+// with bytes past 0x7F after the rest rather than the console strcmp()'s
+// signed order.
+static int reference_compare(uint16_t indexA, uint16_t indexB)
+{
+	const fileData *a = &fileDataBuffer[indexA];
+	const fileData *b = &fileDataBuffer[indexB];
+
+	if ((a->flag == 1) && (b->flag == 0)) return -1;
+	if ((a->flag == 0) && (b->flag == 1)) return 1;
+
+	const unsigned char *nameA = (const unsigned char *)a->filename;
+	const unsigned char *nameB = (const unsigned char *)b->filename;
+	while (*nameA && *nameA == *nameB)
+	{
+		nameA++;
+		nameB++;
+	}
+	return *nameA - *nameB;
+}
+
+// Whether the first `count` entries are in file_manager_sort() order.
+static bool is_sorted(uint16_t count)
+{
+	for (uint16_t i = 1; i < count; i++)
+	{
+		if (reference_compare(fileIndexBuffer[i - 1], fileIndexBuffer[i]) > 0)
+		{
+			fprintf(stderr, "  entry %u '%s' is out of order\n", i, fileDataBuffer[fileIndexBuffer[i]].filename);
+			return false;
+		}
+	}
+	return true;
+}
+
+static int bench(const benchOptions *options, bool collate)
+{
+	static const uint32_t sizes[] = {10, 100, 1000, 4096, 10000, 50000};
+
+	printf("%s pages, batch %s, %s\n", options->compress ? "compressed v2" : collate ? "v2" : "v1", batch_name(options), options->vsync ? "one update per frame" : "unthrottled");
+	printf("%8s %8s %8s %8s %8s %12s %12s %10s %10s\n",
+		"entries", "listed", "commands", "reads", "sectors", "first (ms)", "total (ms)", "cpu (ms)", "last (ms)");
+
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		simFirmwareConfig config = {.collate = collate, .rootPath = NULL, .syntheticCount = sizes[i], .corruptEvery = options->corruptEvery, .compress = options->compress, .total = !options->noTotal};
+		start_firmware(options, &config);
+
+		listingResult result = run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+
+		printf("%8u %8u %8u %8u %8u %12.1f %12.1f %10.2f %10.2f\n",
+			sizes[i], result.count, simCounters.commands, simCounters.reads, simCounters.sectors,
+			result.firstEntryUs / 1000, result.totalUs / 1000, result.cpuUs / 1000, result.lastUs / 1000);
+
+		// Every visible entry has to be counted; only v1 listings are capped.
+		if ((collate || sizes[i] <= MAX_FILE_ITEMS) && result.count != sim_firmware_visible_count())
+		{
+			fprintf(stderr, "  expected %u entries\n", sim_firmware_visible_count());
+			failures++;
+		}
+		if (!collate && !is_sorted(result.count))
+		{
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
+
+// Copies out the current listing so it can be compared with a later one.
+static char **snapshot(uint16_t count, uint16_t **ids)
+{
+	char **names = malloc(sizeof(char *) * (count + 1));
+	*ids = malloc(sizeof(uint16_t) * (count + 1));
+	for (uint16_t i = 0; i < count; i++)
+	{
+		names[i] = strdup(file_manager_get_file_data(i)->filename);
+		(*ids)[i] = file_manager_get_file_index(i);
+	}
+	return names;
+}
+
+static int refresh(const benchOptions *options)
+{
+	static const uint32_t sizes[] = {10, 100, 1000, 4096};
+
+	printf("%s pages, batch %s\n", options->compress ? "compressed v2" : "v2", batch_name(options));
+	printf("%8s %8s %12s %12s %12s %12s %12s\n",
+		"entries", "after", "full (ms)", "same (cmds)", "same (ms)", "8+/4- (cmds)", "8+/4- (ms)");
+
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		simFirmwareConfig config = {.collate = true, .rootPath = NULL, .syntheticCount = sizes[i], .corruptEvery = options->corruptEvery, .compress = options->compress, .total = !options->noTotal};
+		start_firmware(options, &config);
+
+		listingResult full = run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+		uint16_t count = full.count;
+
+		uint32_t commands = simCounters.commands;
+		double start = sim_now();
+		bool same = listing_refresh(&count);
+		uint32_t sameCommands = simCounters.commands - commands;
+		double sameUs = sim_now() - start;
+
+		sim_firmware_change(8, 4);
+		commands = simCounters.commands;
+		start = sim_now();
+		bool changed = listing_refresh(&count);
+		uint32_t changedCommands = simCounters.commands - commands;
+		double changedUs = sim_now() - start;
+
+		printf("%8u %8u %12.1f %12u %12.1f %12u %12.1f\n",
+			sizes[i], count, full.totalUs / 1000, sameCommands, sameUs / 1000, changedCommands, changedUs / 1000);
+
+		// The patched listing has to match what listing it from scratch gives.
+		uint16_t *ids;
+		char **names = snapshot(count, &ids);
+		listingResult again = run_listing(options, COMMAND_GET_NEXT_CONTENTS, 0, NULL);
+		bool match = same && changed && again.count == count;
+		for (uint16_t j = 0; j < count && match; j++)
+		{
+			match = !strcmp(names[j], file_manager_get_file_data(j)->filename) && ids[j] == file_manager_get_file_index(j);
+		}
+		if (!match)
+		{
+			fprintf(stderr, "  patched listing differs from a fresh one\n");
+			failures++;
+		}
+
+		for (uint16_t j = 0; j < count; j++)
+		{
+			free(names[j]);
+		}
+		free(names);
+		free(ids);
+	}
+
+	return failures ? 1 : 0;
+}
+
+// Calls metadata_update() once a frame for rows [start, start + rows) the way
+// main() does until all of them are answered.
+// @return Frames it took, or 0 if it never finished.
+static uint32_t fetch_metadata(uint16_t start, uint16_t rows, uint16_t total)
+{
+	uint16_t ids[LISTING_METADATA_MAX];
+	uint8_t count = 0;
+	for (uint16_t i = start; i < start + rows && i < total && count < LISTING_METADATA_MAX; i++)
+	{
+		fileData *file = listing_getEntry(i);
+		if (file && file->flag == 0)
+		{
+			ids[count++] = file->id;
+		}
+	}
+
+	for (uint32_t frame = 1; frame < 60; frame++)
+	{
+		double t = sim_host_us();
+		double fw = simCounters.firmwareHostUs;
+		metadata_update(ids, count);
+		sim_advance(menu_cpu_since(t, fw) * simTimingModel.cpuScale);
+		sim_advance_to(((double)(long)(sim_now() / FRAME_US) + 1) * FRAME_US);
+
+		uint8_t answered = 0;
+		while (answered < count && metadata_get(ids[answered]))
+		{
+			answered++;
+		}
+		if (answered == count)
+		{
+			return frame;
+		}
+	}
+	return 0;
+}
+
+static int print_metadata(uint16_t count)
+{
+	const uint16_t pageSize = 16; // As in main.c
+	uint32_t commands = simCounters.commands;
+	uint32_t sectors = simCounters.sectors;
+	uint32_t worst = 0;
+
+	metadata_clear();
+	for (uint16_t start = 0; start < count; start += pageSize)
+	{
+		uint32_t frames = fetch_metadata(start, pageSize, count);
+		if (!frames)
+		{
+			fprintf(stderr, "rows %u-%u never got their metadata\n", start + 1, start + pageSize);
+			return 1;
+		}
+		worst = frames > worst ? frames : worst;
+
+		for (uint16_t i = start; i < start + pageSize && i < count; i++)
+		{
+			fileData *file = listing_getEntry(i);
+			const fileMetadata *metadata = file->flag == 0 ? metadata_get(file->id) : NULL;
+			if (metadata && metadata->known)
+			{
+				printf("%-4d %-12s %c %u %10lu %s\n", i + 1, metadata->gameId, metadata->region ? metadata->region : '-',
+					metadata->tracks, (unsigned long)metadata->size, file->filename);
+			}
+			else
+			{
+				printf("%-4d %-12s - - %10s %s\n", i + 1, "", "", file->filename);
+			}
+		}
+	}
+
+	// Going back to the top has everything cached already.
+	uint32_t before = simCounters.commands;
+	if (count && (fetch_metadata(0, pageSize, count) != 1 || simCounters.commands != before))
+	{
+		fprintf(stderr, "metadata of the first rows was asked for again\n");
+		return 1;
+	}
+
+	printf("metadata: %u commands, %u sectors, at most %u frames per screen\n",
+		simCounters.commands - commands, simCounters.sectors - sectors, worst);
+	return 0;
+}
+
+static int list(const benchOptions *options, const char *root, const char **cdNames, int numCdNames, bool collate)
+{
+	simFirmwareConfig config = {.collate = collate, .rootPath = root, .corruptEvery = options->corruptEvery, .compress = options->compress, .total = !options->noTotal};
+	start_firmware(options, &config);
+	print_capabilities();
+
+	listingResult result = run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+	for (int i = 0; i < numCdNames; i++)
+	{
+		uint16_t index = result.count;
+		for (uint16_t j = 0; j < result.count; j++)
+		{
+			fileData *file = file_manager_get_file_data(j);
+			if (file->flag == 1 && !strcmp(file->filename, cdNames[i]))
+			{
+				index = j;
+				break;
+			}
+		}
+		if (index == result.count)
+		{
+			fprintf(stderr, "no folder named '%s'\n", cdNames[i]);
+			return 1;
+		}
+
+		uint16_t id = file_manager_get_file_index(index);
+		if (options->prefetch)
+		{
+			listing_prefetch(id);
+			sim_advance(PREFETCH_DELAY_FRAMES * FRAME_US);
+		}
+		result = run_listing(options, COMMAND_GOTO_DIRECTORY, id, NULL);
+	}
+
+	if (options->path)
+	{
+		simCounters.commands = 0;
+		simCounters.sectors = 0;
+		result = run_listing(options, COMMAND_IO_COMMAND, IO_COMMAND_GOTO_PATH, options->path);
+	}
+
+	uint16_t folderCount = result.count;
+	if (options->search)
+	{
+		result = run_listing(options, COMMAND_IO_COMMAND, IO_COMMAND_SEARCH, options->search);
+	}
+
+	for (uint16_t i = 0; i < result.count; i++)
+	{
+		fileData *file = file_manager_get_file_data(i);
+		printf("%-4d %s %s\n", i + 1, file->flag == 0 ? "F" : "D", file->filename);
+	}
+	printf("%u entries, %u commands, %u sectors, first entry %.1f ms, %.1f ms\n",
+		result.count, simCounters.commands, simCounters.sectors, result.firstEntryUs / 1000, result.totalUs / 1000);
+
+	if (options->metadata && !hasCapability(FIRMWARE_CAP_METADATA))
+	{
+		printf("metadata: not supported by the firmware\n");
+	}
+	else if (options->metadata && print_metadata(result.count))
+	{
+		return 1;
+	}
+
+	if (options->search)
+	{
+		// Leaving the results lands back in the folder searched from.
+		listingResult back = run_listing(options, COMMAND_GOTO_PARENT, 0, NULL);
+		if (back.count != folderCount)
+		{
+			fprintf(stderr, "left search with %u entries, expected %u\n", back.count, folderCount);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Moves the cursor `rows` at a time, one move every `frames` frames, from
+// `from` to `to` the way main() would, and counts the frames where a row on
+// screen wasn't there yet.
+static int scroll_through(const benchOptions *options, uint16_t from, uint16_t to, uint16_t rows, uint32_t frames, uint32_t *stalls)
+{
+	const uint16_t pageSize = 16; // As in main.c
+	uint16_t cursor = from;
+	uint32_t frame = 0;
+
+	for (;;)
+	{
+		listing_setCursor(cursor);
+		double t = sim_host_us();
+		double fw = simCounters.firmwareHostUs;
+		listing_update();
+		sim_advance(menu_cpu_since(t, fw) * simTimingModel.cpuScale);
+
+		uint16_t count = listing_getCount();
+		uint16_t start = cursor > pageSize / 2 ? cursor - pageSize / 2 : 0;
+		bool stalled = false;
+		for (uint16_t i = start; i < start + pageSize && i < count; i++)
+		{
+			fileData *file = listing_getEntry(i);
+			if (!file)
+			{
+				stalled = true;
+			}
+			else if (strcmp(file->filename, sim_firmware_name_at(i)))
+			{
+				fprintf(stderr, "  row %u is '%s', expected '%s'\n", i, file->filename, sim_firmware_name_at(i));
+				return 1;
+			}
+		}
+		*stalls += stalled;
+
+		if (options->vsync)
+		{
+			double next = (double)(long)(sim_now() / FRAME_US) + 1;
+			sim_advance_to(next * FRAME_US);
+		}
+		else
+		{
+			sim_wait_for_drive();
+		}
+
+		if (cursor == to && !stalled)
+		{
+			return 0;
+		}
+		if (++frame % frames == 0 && cursor != to)
+		{
+			if (to > cursor)
+			{
+				cursor = to - cursor > rows ? cursor + rows : to;
+			}
+			else
+			{
+				cursor = cursor - to > rows ? cursor - rows : to;
+			}
+		}
+	}
+}
+
+static int scroll(const benchOptions *options)
+{
+	static const uint32_t sizes[] = {10000, 20000, 50000};
+
+	printf("%s pages, window of %u entries\n", options->compress ? "compressed v2" : "v2", FILE_WINDOW_ENTRIES);
+	printf("%8s %8s %12s %10s %10s %10s %10s\n",
+		"entries", "listed", "counted (ms)", "commands", "sectors", "stalls", "stalls/1");
+
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		simFirmwareConfig config = {.collate = true, .rootPath = NULL, .syntheticCount = sizes[i], .corruptEvery = options->corruptEvery, .compress = options->compress, .total = !options->noTotal};
+		start_firmware(options, &config);
+
+		listing_setCursor(0);
+		listingResult result = run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+		uint16_t last = result.count - 1;
+
+		// Page by page (R1 held) to the end and back, then one row at a
+		// time (d-pad held) over a stretch in the middle.
+		uint32_t stalls = 0;
+		uint32_t rowStalls = 0;
+		int failed = scroll_through(options, 0, last, 16, 2, &stalls) ||
+			scroll_through(options, last, 0, 16, 2, &stalls) ||
+			scroll_through(options, last / 2, last / 2 + 2000, 1, 5, &rowStalls);
+
+		printf("%8u %8u %12.1f %10u %10u %10u %10u\n",
+			sizes[i], result.count, result.totalUs / 1000, simCounters.commands, simCounters.sectors, stalls, rowStalls);
+
+		if (failed || !listing_isWindowed() || result.count != sim_firmware_visible_count())
+		{
+			fprintf(stderr, "  expected %u entries in a window\n", sim_firmware_visible_count());
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
+
+static void reference_quicksort(uint16_t left, uint16_t right)
+{
+	if (left >= right)
+	{
+		return;
+	}
+
+	int pivotIndex = fileIndexBuffer[(left + right) / 2];
+	int i = left;
+	int j = right;
+	while (i <= j)
+	{
+		while (reference_compare(fileIndexBuffer[i], pivotIndex) < 0) i++;
+		while (reference_compare(fileIndexBuffer[j], pivotIndex) > 0) j--;
+		if (i <= j)
+		{
+			uint16_t temp = fileIndexBuffer[i];
+			fileIndexBuffer[i] = fileIndexBuffer[j];
+			fileIndexBuffer[j] = temp;
+			i++;
+			j--;
+		}
+	}
+
+	if (left < j) reference_quicksort(left, j);
+	if (i < right) reference_quicksort(i, right);
+}
+
+// Host CPU cycles where the TSC is available, nanoseconds elsewhere.
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Sorts slots [0, count) from directory order and returns the fewest cycles
+// over a few runs, leaving the sorted order in `order`.
+static uint64_t time_sort(bool reference, uint16_t count, uint16_t *order)
+{
+	uint64_t best = UINT64_MAX;
+	for (int run = 0; run < 7; run++)
+	{
+		for (uint16_t i = 0; i < count; i++)
+		{
+			fileIndexBuffer[i] = i;
+		}
+
+		uint64_t start = cycles();
+		if (reference)
+		{
+			reference_quicksort(0, count - 1);
+		}
+		else
+		{
+			file_manager_sort(count);
+		}
+		uint64_t taken = cycles() - start;
+		best = taken < best ? taken : best;
+	}
+
+	memcpy(order, fileIndexBuffer, sizeof(uint16_t) * count);
+	return best;
+}
+
+// The adjacent-pair bin/cue cleanup file_manager_clean_list() used before it
+// hashed names, kept as the baseline for `sort`.
+static void reference_clean_list(uint16_t *count)
+{
+	int i = 0;
+	while (i < *count - 1)
+	{
+		const char *binName = fileDataBuffer[fileIndexBuffer[i]].filename;
+		size_t len = strlen(binName);
+		if (len >= 4 && strcmp(binName + len - 4, ".bin") == 0)
+		{
+			const char *cueName = fileDataBuffer[fileIndexBuffer[i + 1]].filename;
+			if (strlen(cueName) == len && strncmp(binName, cueName, len - 4) == 0 && strcmp(cueName + len - 4, ".cue") == 0)
+			{
+				for (int j = i; j < *count - 1; ++j)
+				{
+					fileIndexBuffer[j] = fileIndexBuffer[j + 1];
+				}
+				(*count)--;
+				continue;
+			}
+		}
+		i++;
+	}
+}
+
+// Cleans up the sorted `order` and returns the fewest cycles over a few runs,
+// leaving what is left in `kept`.
+static uint64_t time_clean(bool reference, uint16_t count, const uint16_t *order, uint16_t *kept)
+{
+	uint64_t best = UINT64_MAX;
+	for (int run = 0; run < 7; run++)
+	{
+		memcpy(fileIndexBuffer, order, sizeof(uint16_t) * count);
+		*kept = count;
+
+		uint64_t start = cycles();
+		if (reference)
+		{
+			reference_clean_list(kept);
+		}
+		else
+		{
+			file_manager_clean_list(kept);
+		}
+		uint64_t taken = cycles() - start;
+		best = taken < best ? taken : best;
+	}
+	return best;
+}
+
+// Only up to MAX_FILE_ITEMS: that is all the menu ever sorts, larger folders
+// are collated by the firmware.
+static int sort(const benchOptions *options)
+{
+	static const uint16_t sizes[] = {256, 1024, 4096};
+
+	printf("%8s %14s %14s %8s %14s %14s %8s %14s %14s\n", "entries", "quicksort", "radix", "speedup", "pair clean", "hash clean", "speedup", "natural", "switch");
+
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		// A v1 listing leaves the names in slots [0, count) in directory order.
+		simFirmwareConfig config = {.collate = false, .rootPath = NULL, .syntheticCount = sizes[i]};
+		start_firmware(options, &config);
+		run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+
+		uint16_t reference[MAX_FILE_ITEMS];
+		uint16_t sorted[MAX_FILE_ITEMS];
+		uint64_t before = time_sort(true, sizes[i], reference);
+		uint64_t after = time_sort(false, sizes[i], sorted);
+		for (uint16_t j = 0; j < sizes[i]; j++)
+		{
+			if (strcmp(fileDataBuffer[reference[j]].filename, fileDataBuffer[sorted[j]].filename))
+			{
+				fprintf(stderr, "  entry %u is '%s', expected '%s'\n", j, fileDataBuffer[sorted[j]].filename, fileDataBuffer[reference[j]].filename);
+				failures++;
+				break;
+			}
+		}
+
+		// Synthetic bins sort right before their cues, so both cleanups
+		// should leave the same entries.
+		uint16_t referenceKept;
+		uint16_t kept;
+		uint64_t cleanBefore = time_clean(true, sizes[i], sorted, &referenceKept);
+		memcpy(reference, fileIndexBuffer, sizeof(uint16_t) * referenceKept);
+		uint64_t cleanAfter = time_clean(false, sizes[i], sorted, &kept);
+		memcpy(sorted, fileIndexBuffer, sizeof(uint16_t) * kept);
+
+		// The first switch to another order sorts the cleaned up listing
+		// again; switching back and forth after that only swaps orders.
+		uint64_t start = cycles();
+		file_manager_set_sort_mode(FILE_SORT_NATURAL, kept);
+		uint64_t natural = cycles() - start;
+		start = cycles();
+		file_manager_set_sort_mode(FILE_SORT_NAME, kept);
+		file_manager_set_sort_mode(FILE_SORT_NATURAL, kept);
+		uint64_t switched = cycles() - start;
+		file_manager_set_sort_mode(FILE_SORT_NAME, kept);
+
+		printf("%8u %14llu %14llu %7.1fx %14llu %14llu %7.1fx %14llu %14llu\n", sizes[i],
+			(unsigned long long)before, (unsigned long long)after, (double)before / after,
+			(unsigned long long)cleanBefore, (unsigned long long)cleanAfter, (double)cleanBefore / cleanAfter,
+			(unsigned long long)natural, (unsigned long long)switched);
+
+		if (kept != referenceKept || memcmp(reference, sorted, sizeof(uint16_t) * kept))
+		{
+			fprintf(stderr, "  cleanup kept %u entries, expected %u\n", kept, referenceKept);
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
+
+// Whether `text`, folded the way filter_set() does, is in entry `index`'s
+// folded name, without the filter's shadows or saved offsets.
+static bool plain_match(uint16_t index, const char *text)
+{
+	const fileData *file = file_manager_get_file_data(index);
+	char name[MAX_FILE_LENGTH + 1];
+	char query[MAX_FILE_LENGTH + 1];
+	name[file_manager_fold_name(name, file->filename, file->length)] = 0;
+	query[file_manager_fold_name(query, text, strlen(text))] = 0;
+	return strstr(name, query) != NULL;
+}
+
+static int filter(const benchOptions *options)
+{
+	static const char typed[] = "Metal Gear Solid (Disc 2)";
+
+	// A v1 listing fills slots [0, count); look at all of them in that order
+	// rather than at the sorted, cleaned up listing.
+	simFirmwareConfig config = {.collate = false, .rootPath = NULL, .syntheticCount = MAX_FILE_ITEMS};
+	start_firmware(options, &config);
+	run_listing(options, COMMAND_GOTO_ROOT, 0, NULL);
+	for (uint16_t i = 0; i < MAX_FILE_ITEMS; i++)
+	{
+		fileIndexBuffer[i] = i;
+	}
+
+	printf("%-28s %8s %12s %12s\n", "typed", "matches", "refine", "rescan");
+
+	int failures = 0;
+	char text[sizeof(typed)] = "";
+	filter_clear();
+	for (size_t length = 1; length < sizeof(typed); length++)
+	{
+		memcpy(text, typed, length);
+		text[length] = 0;
+
+		uint64_t start = cycles();
+		filter_set(text, MAX_FILE_ITEMS);
+		uint64_t refine = cycles() - start;
+		uint16_t matches = filter_getCount();
+
+		// The same text from scratch, which is what deleting a character costs.
+		uint64_t rescan = UINT64_MAX;
+		for (int run = 0; run < 3; run++)
+		{
+			filter_clear();
+			start = cycles();
+			filter_set(text, MAX_FILE_ITEMS);
+			uint64_t taken = cycles() - start;
+			rescan = taken < rescan ? taken : rescan;
+		}
+
+		printf("%-28s %8u %12llu %12llu\n", text, matches, (unsigned long long)refine, (unsigned long long)rescan);
+
+		uint16_t row = 0;
+		for (uint16_t i = 0; i < MAX_FILE_ITEMS; i++)
+		{
+			if (!plain_match(i, text))
+			{
+				continue;
+			}
+			if (row >= filter_getCount() || filter_getIndex(row) != i)
+			{
+				fprintf(stderr, "  '%s' should match entry %u\n", text, i);
+				failures++;
+				break;
+			}
+			row++;
+		}
+		if (row != filter_getCount() || matches != row)
+		{
+			fprintf(stderr, "  '%s' matched %u entries, expected %u\n", text, matches, row);
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
+
+typedef struct
+{
+	const char *name;
+	uint8_t flag;
+} checkEntry;
+
+// Puts `entries` in slots [0, count) in the given order, as a listing would.
+static void load_entries(const checkEntry *entries, uint16_t count)
+{
+	file_manager_clear();
+	for (uint16_t i = 0; i < count; i++)
+	{
+		file_manager_init_file_data(i, i, entries[i].flag, entries[i].name, strlen(entries[i].name));
+	}
+}
+
+static int expect_names(const char *label, uint16_t count, const char *const *expected, uint16_t expectedCount)
+{
+	bool same = count == expectedCount;
+	for (uint16_t i = 0; same && i < count; i++)
+	{
+		same = !strcmp(file_manager_get_file_data(i)->filename, expected[i]);
+	}
+
+	printf("%-40s %s\n", label, same ? "ok" : "FAIL");
+	if (!same)
+	{
+		for (uint16_t i = 0; i < count || i < expectedCount; i++)
+		{
+			fprintf(stderr, "  %3u  %-30s %s\n", i, i < count ? file_manager_get_file_data(i)->filename : "-", i < expectedCount ? expected[i] : "-");
+		}
+	}
+	return same ? 0 : 1;
+}
+
+static int expect(const char *label, bool passed)
+{
+	printf("%-40s %s\n", label, passed ? "ok" : "FAIL");
+	return passed ? 0 : 1;
+}
+
+// Names over a two-letter alphabet tie on long prefixes, end at every
+// length from 0 up and repeat, which is what the radix sort's runs and the
+// merge's key comparisons have to get right.
+static void load_random(uint16_t count, uint32_t seed)
+{
+	static char names[MAX_FILE_ITEMS][16];
+	file_manager_clear();
+	for (uint16_t i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		uint8_t length = (seed >> 16) % 13;
+		for (uint8_t j = 0; j < length; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			names[i][j] = (seed >> 16) & 1 ? 'b' : (seed >> 17) & 1 ? 'a' : '\xe9';
+		}
+		names[i][length] = 0;
+		file_manager_init_file_data(i, i, (seed >> 20) % 5 == 0, names[i], length);
+	}
+}
+
+static int check(void)
+{
+	int failures = 0;
+
+	static const char *const none[] = {NULL};
+	load_entries(NULL, 0);
+	uint16_t count = 0;
+	file_manager_sort(count);
+	file_manager_merge_runs(count);
+	file_manager_clean_list(&count);
+	failures += expect_names("empty listing", count, none, 0);
+
+	static const checkEntry single[] = {{"Game.bin", 0}};
+	static const char *const singleSorted[] = {"Game.bin"};
+	load_entries(single, 1);
+	count = 1;
+	file_manager_sort(count);
+	file_manager_clean_list(&count);
+	failures += expect_names("single entry", count, singleSorted, 1);
+
+	static const checkEntry mixed[] = {
+		{"b", 0}, {"Zelda", 1}, {"a", 0}, {"Apps", 1}, {"B", 0}, {"\xe9t\xe9", 0}, {"Game 10", 0}, {"Game 2", 0},
+		{"Game", 0}, {"Game 1", 0}, {"Game", 1}, {"Game 1", 0},
+	};
+	static const char *const mixedSorted[] = {
+		"Apps", "Game", "Zelda", "B", "Game", "Game 1", "Game 1", "Game 10", "Game 2", "a", "b", "\xe9t\xe9",
+	};
+	const uint16_t mixedCount = sizeof(mixed) / sizeof(mixed[0]);
+	load_entries(mixed, mixedCount);
+	file_manager_sort(mixedCount);
+	failures += expect_names("folders first, then strcmp order", mixedCount, mixedSorted, mixedCount);
+
+	load_entries(mixed, mixedCount);
+	for (uint16_t end = 3; end < mixedCount; end += 3)
+	{
+		file_manager_sort_run(end);
+	}
+	file_manager_merge_runs(mixedCount);
+	failures += expect_names("same, sorted a page at a time", mixedCount, mixedSorted, mixedCount);
+
+	static const char *const mixedNatural[] = {
+		"Apps", "Game", "Zelda", "B", "Game", "Game 1", "Game 1", "Game 2", "Game 10", "a", "b", "\xe9t\xe9",
+	};
+	static const char *const mixedNoCase[] = {
+		"Apps", "Game", "Zelda", "a", "B", "b", "Game", "Game 1", "Game 1", "Game 10", "Game 2", "\xe9t\xe9",
+	};
+	file_manager_set_sort_mode(FILE_SORT_NATURAL, mixedCount);
+	failures += expect_names("natural order", mixedCount, mixedNatural, mixedCount);
+	file_manager_set_sort_mode(FILE_SORT_NO_CASE, mixedCount);
+	failures += expect_names("case-insensitive order", mixedCount, mixedNoCase, mixedCount);
+	file_manager_set_sort_mode(FILE_SORT_NAME, mixedCount);
+	failures += expect_names("back to name order", mixedCount, mixedSorted, mixedCount);
+
+	static const char *const insertedNatural[] = {
+		"Apps", "Game", "Zelda", "B", "Game", "Game 1", "Game 1", "Game 2", "Game 3", "Game 10", "a", "b", "\xe9t\xe9",
+	};
+	count = mixedCount;
+	file_manager_set_sort_mode(FILE_SORT_NATURAL, count);
+	file_manager_insert_sorted(100, 0, "Game 3", 6, &count);
+	failures += expect("adding an entry goes back to name order", file_manager_get_sort_mode() == FILE_SORT_NAME);
+	file_manager_set_sort_mode(FILE_SORT_NATURAL, count);
+	failures += expect_names("natural order worked out again", count, insertedNatural, count);
+
+	// Names tying on their first four bytes are finished by comparing the
+	// rest, which has to agree with the radix keys on bytes past 0x7F.
+	static const checkEntry highBytes[] = {{"abcd\xe9", 0}, {"abcdz", 0}, {"abcd\xe9z", 0}, {"abcdZ", 0}};
+	static const char *const highBytesSorted[] = {"abcdZ", "abcdz", "abcd\xe9", "abcd\xe9z"};
+	load_entries(highBytes, 4);
+	file_manager_sort(4);
+	failures += expect_names("high bytes past a tie", 4, highBytesSorted, 4);
+
+	load_entries(highBytes, 4);
+	file_manager_sort_run(1);
+	file_manager_sort_run(2);
+	file_manager_merge_runs(4);
+	failures += expect_names("same, merged", 4, highBytesSorted, 4);
+
+	load_entries(highBytes, 2);
+	file_manager_sort(2);
+	count = 2;
+	file_manager_insert_sorted(9, 0, "abcdZ", 5, &count);
+	failures += expect_names("same, inserted", count, highBytesSorted, 3);
+
+	// Pairs far apart and in either order, multi-track sets, and a folder
+	// that only looks like an image.
+	static const checkEntry images[] = {
+		{"A.cue", 0}, {"B.bin", 0}, {"C (Track 02).bin", 0}, {"E.bin", 1}, {"A.bin", 0}, {"C.cue", 0},
+		{"D Track 1.bin", 0}, {"C (Track 01).bin", 0}, {"D.cue", 0}, {"E.cue", 0}, {"F (Track 100).bin", 0},
+		{"F.cue", 0}, {".bin", 0}, {".cue", 0},
+	};
+	static const char *const imagesKept[] = {
+		"A.cue", "B.bin", "E.bin", "C.cue", "D.cue", "E.cue", "F (Track 100).bin", "F.cue", ".bin", ".cue",
+	};
+	count = sizeof(images) / sizeof(images[0]);
+	load_entries(images, count);
+	file_manager_clean_list(&count);
+	failures += expect_names("bin/cue cleanup, any order", count, imagesKept, sizeof(imagesKept) / sizeof(imagesKept[0]));
+
+	static const checkEntry onlyBins[] = {{"A.bin", 0}, {"B.bin", 0}};
+	static const char *const onlyBinsKept[] = {"A.bin", "B.bin"};
+	count = 2;
+	load_entries(onlyBins, count);
+	file_manager_clean_list(&count);
+	failures += expect_names("bins without cues stay", count, onlyBinsKept, 2);
+
+	bool sorted = true;
+	for (uint32_t seed = 1; seed <= 8 && sorted; seed++)
+	{
+		uint16_t randomCount = seed * 500;
+		load_random(randomCount, seed);
+		file_manager_sort(randomCount);
+		sorted = is_sorted(randomCount);
+
+		load_random(randomCount, seed);
+		for (uint16_t end = seed * 7; end < randomCount; end += seed * 7 + end / 8)
+		{
+			file_manager_sort_run(end);
+		}
+		file_manager_merge_runs(randomCount);
+		sorted = sorted && is_sorted(randomCount);
+	}
+	failures += expect("random names with long ties", sorted);
+
+	// A full listing whose names would fill the name store is cached; one
+	// with longer names is over the budget and left out, without pushing out
+	// what is cached already.
+	static char longName[MAX_FILE_LENGTH + 1];
+	uint16_t restored;
+	uint16_t generation;
+	dir_cache_clear();
+	memset(longName, 'n', MAX_FILE_LENGTH);
+	const uint16_t fullLength = FILE_NAME_CHUNK_SIZE * FILE_NAME_CHUNKS / MAX_FILE_ITEMS - 1;
+	file_manager_clear();
+	for (uint16_t i = 0; i < MAX_FILE_ITEMS; i++)
+	{
+		file_manager_ref_file_data(i, i, 0, longName + MAX_FILE_LENGTH - fullLength, fullLength);
+	}
+	dir_cache_store(1, MAX_FILE_ITEMS, 0);
+	failures += expect("listing filling the name store is cached",
+		dir_cache_restore(1, &restored, &generation) && restored == MAX_FILE_ITEMS);
+
+	file_manager_clear();
+	for (uint16_t i = 0; i < MAX_FILE_ITEMS; i++)
+	{
+		file_manager_ref_file_data(i, i, 0, longName, MAX_FILE_LENGTH);
+	}
+	dir_cache_store(2, MAX_FILE_ITEMS, 0);
+	failures += expect("listing over the budget is not cached", !dir_cache_restore(2, &restored, &generation));
+	failures += expect("and leaves the cache alone", dir_cache_restore(1, &restored, &generation));
+	dir_cache_clear();
+
+	// A v1 page: length, flag and name per entry, then a zero length and 1 if
+	// more pages follow, or 0, 0xFF, 0xFF on the folder's last page.
+	static char page[LISTING_SECTOR_SIZE];
+	static const char *const pageNames[] = {"Folder", "Game.cue", "Game.bin"};
+	memset(page, 0, sizeof(page));
+	uint16_t offset = 0;
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		page[offset] = strlen(pageNames[i]);
+		page[offset + 1] = i == 0;
+		memcpy(&page[offset + 2], pageNames[i], strlen(pageNames[i]));
+		offset += strlen(pageNames[i]) + 2;
+	}
+	page[offset + 1] = 1;
+	file_manager_clear();
+	count = 0;
+	bool more = doLookup(&count, page);
+	failures += expect("v1 page says more pages follow", more && file_manager_get_file_data(0)->flag == 1);
+	failures += expect_names("v1 page names", count, pageNames, 3);
+
+	page[offset + 1] = 0;
+	page[offset + 2] = (char)0xFF;
+	page[offset + 3] = (char)0xFF;
+	file_manager_clear();
+	count = 0;
+	more = doLookup(&count, page);
+	failures += expect("v1 page is the last one", !more);
+	failures += expect_names("last v1 page names", count, pageNames, 3);
+
+	memset(page, 0, sizeof(page));
+	page[1] = 1;
+	file_manager_clear();
+	count = 0;
+	more = doLookup(&count, page);
+	failures += expect_names("empty v1 page", count, none, 0);
+	failures += expect("empty v1 page says more pages follow", more);
+
+	page[1] = 0;
+	page[2] = (char)0xFF;
+	page[3] = (char)0xFF;
+	count = 0;
+	more = doLookup(&count, page);
+	failures += expect("empty v1 page is the last one", !more && count == 0);
+
+	return failures ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: listing-sim list <dir> [--cd <name>]... [options]\n"
+		"       listing-sim bench [options]\n"
+		"       listing-sim refresh [options]\n"
+		"       listing-sim scroll [options]\n"
+		"       listing-sim sort\n"
+		"       listing-sim filter\n"
+		"       listing-sim check\n"
+		"options: --v2 --compress --no-total --prefetch --metadata --path <path> --search <text> --batch <K> --no-vsync --cpu-scale <X> --corrupt-every <N>\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 2;
+	}
+
+	benchOptions options = {.vsync = true, .batch = 0, .corruptEvery = 0, .compress = false, .prefetch = false, .path = NULL, .search = NULL, .metadata = false, .noTotal = false};
+	bool collate = false;
+	const char *root = NULL;
+	const char *cdNames[MAX_CD_NAMES];
+	int numCdNames = 0;
+
+	int arg = 2;
+	if (!strcmp(argv[1], "list"))
+	{
+		if (argc < 3)
+		{
+			usage();
+			return 2;
+		}
+		root = argv[arg++];
+	}
+	else if (strcmp(argv[1], "bench") && strcmp(argv[1], "refresh") && strcmp(argv[1], "scroll") && strcmp(argv[1], "sort") &&
+		strcmp(argv[1], "filter") && strcmp(argv[1], "check"))
+	{
+		usage();
+		return 2;
+	}
+
+	for (; arg < argc; arg++)
+	{
+		if (!strcmp(argv[arg], "--v2"))
+		{
+			collate = true;
+		}
+		else if (!strcmp(argv[arg], "--compress"))
+		{
+			collate = true;
+			options.compress = true;
+		}
+		else if (!strcmp(argv[arg], "--no-total"))
+		{
+			options.noTotal = true;
+		}
+		else if (!strcmp(argv[arg], "--metadata"))
+		{
+			options.metadata = true;
+		}
+		else if (!strcmp(argv[arg], "--prefetch"))
+		{
+			options.prefetch = true;
+		}
+		else if (!strcmp(argv[arg], "--no-vsync"))
+		{
+			options.vsync = false;
+		}
+		else if (!strcmp(argv[arg], "--batch") && arg + 1 < argc)
+		{
+			options.batch = (uint8_t)atoi(argv[++arg]);
+		}
+		else if (!strcmp(argv[arg], "--cpu-scale") && arg + 1 < argc)
+		{
+			simTimingModel.cpuScale = atof(argv[++arg]);
+		}
+		else if (!strcmp(argv[arg], "--corrupt-every") && arg + 1 < argc)
+		{
+			options.corruptEvery = (uint32_t)atoi(argv[++arg]);
+		}
+		else if (!strcmp(argv[arg], "--path") && arg + 1 < argc)
+		{
+			options.path = argv[++arg];
+		}
+		else if (!strcmp(argv[arg], "--search") && arg + 1 < argc)
+		{
+			options.search = argv[++arg];
+		}
+		else if (!strcmp(argv[arg], "--cd") && arg + 1 < argc && numCdNames < MAX_CD_NAMES)
+		{
+			cdNames[numCdNames++] = argv[++arg];
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	file_manager_init();
+
+	if (root)
+	{
+		return list(&options, root, cdNames, numCdNames, collate);
+	}
+	if (!strcmp(argv[1], "refresh"))
+	{
+		return refresh(&options);
+	}
+	if (!strcmp(argv[1], "sort"))
+	{
+		return sort(&options);
+	}
+	if (!strcmp(argv[1], "filter"))
+	{
+		return filter(&options);
+	}
+	if (!strcmp(argv[1], "check"))
+	{
+		return check();
+	}
+	if (!strcmp(argv[1], "scroll"))
+	{
+		return scroll(&options);
+	}
+	return bench(&options, collate);
+}
+
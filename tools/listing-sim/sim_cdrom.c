@@ -0,0 +1,181 @@
+// Implements the psxproject/cdrom.h interface on the host, routing picostation
+// commands to the simulated firmware and timing the drive with a simple model
+// so the listing code can be run and measured unmodified.
+
+#include "sim_cdrom.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "ps1/cdrom.h"
+#include "psxproject/cdrom.h"
+#include "sim_firmware.h"
+#include "listing.h"
+
+volatile bool waitingForInt1;
+volatile bool waitingForInt2;
+volatile bool waitingForInt3;
+volatile bool waitingForInt4;
+volatile bool waitingForInt5 = true;
+
+bool cdromDataReady;
+
+void  *cdromReadDataPtr;
+size_t cdromReadDataSectorSize;
+volatile size_t cdromReadDataNumSectors;
+
+uint8_t cdromResponse[16];
+uint8_t cdromRespLength;
+uint8_t cdromStatus;
+
+uint8_t cdromLastReadPurpose;
+
+simTiming simTimingModel = {
+	.commandUs = 1000,
+	.readStartUs = 13000,
+	.sectorUs = 6667,
+	.cpuScale = 1.0,
+};
+simStats simCounters;
+
+static double simNow;
+static double driveFree;
+static double readDoneAt;
+static bool readPending;
+
+static void sim_complete_read(void)
+{
+	if (readPending && simNow >= readDoneAt)
+	{
+		readPending = false;
+		cdromReadDataNumSectors = 0;
+		waitingForInt1 = false;
+		cdromDataReady = true;
+	}
+}
+
+static double sim_drive_busy(double us)
+{
+	double start = simNow > driveFree ? simNow : driveFree;
+	driveFree = start + us;
+	simCounters.driveUs += us;
+	return driveFree;
+}
+
+void issueCDROMCommand(uint8_t cmd, const uint8_t *arg, size_t argLength)
+{
+	waitingForInt1 = true;
+	waitingForInt2 = true;
+	waitingForInt3 = true;
+	waitingForInt4 = true;
+	waitingForInt5 = true;
+	cdromDataReady = false;
+
+	if (cmd == CDROM_CMD_TEST && argLength == 4 && arg[0] == CDROM_TEST_DSP_CMD && (arg[1] & 0xF0) == 0xF0)
+	{
+		simCounters.commands++;
+		sim_drive_busy(simTimingModel.commandUs);
+		double t = sim_host_us();
+		sim_firmware_command(arg[1] & 0x0F, (arg[2] << 8) | arg[3]);
+		simCounters.firmwareHostUs += sim_host_us() - t;
+		cdromRespLength = 1 + sim_firmware_response(&cdromResponse[1]);
+	}
+
+	// Commands are acknowledged immediately; only reads take time.
+	waitingForInt3 = false;
+}
+
+void waitForINT1(void)
+{
+	sim_wait_for_drive();
+}
+
+void waitForINT3(void)
+{
+}
+
+void startCDROMRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait)
+{
+	issueCDROMCommand(CDROM_CMD_READ_N, NULL, 0);
+
+	cdromReadDataPtr = ptr;
+	cdromReadDataSectorSize = sectorSize;
+	cdromReadDataNumSectors = numSectors;
+
+	double t = sim_host_us();
+	for (size_t i = 0; i < numSectors; i++)
+	{
+		uint8_t *sector = (uint8_t *)ptr + i * sectorSize;
+		if (lba == LISTING_LBA && sectorSize == LISTING_SECTOR_SIZE)
+		{
+			sim_firmware_read_sector(i, sector);
+		}
+		else
+		{
+			memset(sector, 0, sectorSize);
+		}
+	}
+
+	simCounters.firmwareHostUs += sim_host_us() - t;
+
+	simCounters.reads++;
+	simCounters.sectors += numSectors;
+	readDoneAt = sim_drive_busy(simTimingModel.readStartUs + simTimingModel.sectorUs * numSectors);
+	readPending = true;
+
+	if (wait)
+	{
+		sim_wait_for_drive();
+	}
+}
+
+void delayMicroseconds(int time)
+{
+	sim_advance(time);
+}
+
+void sim_reset(void)
+{
+	memset(&simCounters, 0, sizeof(simCounters));
+	simNow = 0;
+	driveFree = 0;
+	readPending = false;
+	waitingForInt1 = false;
+	waitingForInt5 = true;
+	cdromReadDataNumSectors = 0;
+}
+
+void sim_advance(double us)
+{
+	simNow += us;
+	sim_complete_read();
+}
+
+void sim_advance_to(double us)
+{
+	if (us > simNow)
+	{
+		simNow = us;
+	}
+	sim_complete_read();
+}
+
+void sim_wait_for_drive(void)
+{
+	if (readPending)
+	{
+		sim_advance_to(readDoneAt);
+	}
+}
+
+double sim_now(void)
+{
+	return simNow;
+}
+
+double sim_host_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// Drive timing model, in microseconds of console time.
+typedef struct
+{
+	double commandUs;   // One CDROM_CMD_TEST round trip to the firmware
+	double readStartUs; // SETMODE + SETLOC + READ_N until the first sector
+	double sectorUs;    // Each 2340-byte sector at double speed
+	double cpuScale;    // Host CPU time to console CPU time
+} simTiming;
+
+typedef struct
+{
+	uint32_t commands;
+	uint32_t reads;
+	uint32_t sectors;
+	double driveUs;
+	double firmwareHostUs; // Host time spent inside the firmware model
+} simStats;
+
+extern simTiming simTimingModel;
+extern simStats simCounters;
+
+void sim_reset(void);
+void sim_advance(double us);
+void sim_advance_to(double us);
+void sim_wait_for_drive(void);
+double sim_now(void);
+double sim_host_us(void);
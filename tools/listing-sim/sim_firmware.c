@@ -0,0 +1,1058 @@
+#include "sim_firmware.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "listing.h"
+#include "picostation.h"
+
+#define SIM_MAX_DEPTH 32
+#define SIM_MAX_NAME 255
+
+// v1 pages need room for a 4-byte terminator: doLookup() peeks three bytes
+// past a zero length to decide whether another page follows.
+#define SIM_TERMINATOR_SIZE 4
+
+static simFirmwareConfig config;
+
+static simEntry *entries;     // Current folder in firmware (directory) order
+static uint8_t *pairedBin;    // Entry is a .bin with a matching .cue
+static uint32_t entryCount;
+static uint32_t *order;       // Entries as the menu sees them, by firmware index
+static uint32_t orderCount;
+
+static char *pathStack[SIM_MAX_DEPTH];
+static int depth;
+
+static uint16_t ioCommand;        // IO_COMMAND_* the COMMAND_IO_DATA words are for
+static char ioText[4096];         // Its string argument so far
+static uint32_t ioLength;
+static char searchQuery[sizeof(ioText)];
+static bool inResults;            // Current folder is the search results
+
+static uint32_t answerFirst;  // First entry of the prepared answer
+static uint32_t answerPages;
+static bool answerChanges;    // Prepared answer is a COMMAND_GET_CHANGES page
+static uint16_t answerSince;
+static bool answerMetadata;   // Prepared answer is an IO_COMMAND_METADATA page
+static uint16_t metadataIds[LISTING_METADATA_MAX];
+static uint32_t metadataCount;
+static uint8_t response[CAPABILITIES_RESPONSE_LENGTH - 1];
+static uint8_t responseLength;
+
+static uint16_t generation;       // Bumped on every change and folder reload
+static uint16_t folderGeneration; // Generation the folder was loaded at
+static char mountedName[SIM_MAX_NAME + 1];
+static uint32_t sectorsServed;
+
+static void free_entries(void)
+{
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		free(entries[i].name);
+	}
+	free(entries);
+	free(pairedBin);
+	free(order);
+	entries = NULL;
+	pairedBin = NULL;
+	order = NULL;
+	entryCount = 0;
+	orderCount = 0;
+}
+
+static void add_entry(const char *name, uint8_t isDir)
+{
+	if (strlen(name) > SIM_MAX_NAME)
+	{
+		return;
+	}
+
+	entries = realloc(entries, sizeof(simEntry) * (entryCount + 1));
+	entries[entryCount].name = strdup(name);
+	entries[entryCount].isDir = isDir;
+	entries[entryCount].addedGeneration = folderGeneration;
+	entries[entryCount].removedGeneration = 0;
+	entryCount++;
+}
+
+// Game-library-looking names: mostly bin/cue pairs sharing long prefixes, a
+// few folders, handed out in a scrambled (directory table) order.
+static void load_synthetic(uint32_t count)
+{
+	static const char *titles[] = {
+		"Final Fantasy VII", "Metal Gear Solid", "Crash Bandicoot", "Spyro the Dragon",
+		"Tekken 3", "Gran Turismo 2", "Castlevania - Symphony of the Night", "Resident Evil 2",
+	};
+	const uint32_t numTitles = sizeof(titles) / sizeof(titles[0]);
+
+	char name[SIM_MAX_NAME + 1];
+	uint32_t i = 0;
+	for (; i < count / 16 && i < count; i++)
+	{
+		snprintf(name, sizeof(name), "Collection %04u", i);
+		add_entry(name, 1);
+	}
+	for (uint32_t n = 0; i < count; n++)
+	{
+		const char *title = titles[n % numTitles];
+		snprintf(name, sizeof(name), "%s (Disc %u) (v%u.%u).bin", title, n / numTitles + 1, n % 3, n % 7);
+		add_entry(name, 0);
+		if (++i < count)
+		{
+			snprintf(name, sizeof(name), "%s (Disc %u) (v%u.%u).cue", title, n / numTitles + 1, n % 3, n % 7);
+			add_entry(name, 0);
+			i++;
+		}
+	}
+
+	uint32_t seed = 12345;
+	for (uint32_t j = entryCount - 1; j > 0 && entryCount > 1; j--)
+	{
+		seed = seed * 1103515245 + 12345;
+		uint32_t k = (seed >> 8) % (j + 1);
+		simEntry tmp = entries[j];
+		entries[j] = entries[k];
+		entries[k] = tmp;
+	}
+}
+
+static bool contains_nocase(const char *name, const char *query)
+{
+	for (; *name; name++)
+	{
+		size_t i = 0;
+		while (query[i] && tolower((uint8_t)name[i]) == tolower((uint8_t)query[i]))
+		{
+			i++;
+		}
+		if (!query[i])
+		{
+			return true;
+		}
+	}
+	return !*query;
+}
+
+// Adds every file under `path` matching the query, named relative to the
+// folder the walk started in.
+static void search_directory(const char *path, const char *prefix)
+{
+	DIR *dir = opendir(path);
+	if (!dir)
+	{
+		return;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)))
+	{
+		if (ent->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		char name[4096];
+		snprintf(name, sizeof(name), "%s%s%s", prefix, *prefix ? "/" : "", ent->d_name);
+		if (ent->d_type == DT_DIR)
+		{
+			char child[4096];
+			snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+			search_directory(child, name);
+		}
+		else if (contains_nocase(ent->d_name, searchQuery))
+		{
+			add_entry(name, 0);
+		}
+	}
+	closedir(dir);
+}
+
+static void load_results(void)
+{
+	if (config.rootPath)
+	{
+		search_directory(config.rootPath, "");
+		return;
+	}
+
+	load_synthetic(config.syntheticCount);
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if (!entries[i].isDir && contains_nocase(entries[i].name, searchQuery))
+		{
+			entries[kept++] = entries[i];
+		}
+		else
+		{
+			free(entries[i].name);
+		}
+	}
+	entryCount = kept;
+}
+
+static void load_directory(void)
+{
+	free_entries();
+
+	if (inResults)
+	{
+		load_results();
+		return;
+	}
+
+	if (!config.rootPath)
+	{
+		if (depth == 0)
+		{
+			load_synthetic(config.syntheticCount);
+		}
+		return;
+	}
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s", config.rootPath);
+	for (int i = 0; i < depth; i++)
+	{
+		strncat(path, "/", sizeof(path) - strlen(path) - 1);
+		strncat(path, pathStack[i], sizeof(path) - strlen(path) - 1);
+	}
+
+	DIR *dir = opendir(path);
+	if (!dir)
+	{
+		return;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)))
+	{
+		if (ent->d_name[0] == '.')
+		{
+			continue;
+		}
+		add_entry(ent->d_name, ent->d_type == DT_DIR);
+	}
+	closedir(dir);
+}
+
+static const simEntry *entry_at(uint32_t index)
+{
+	return &entries[order[index]];
+}
+
+// The picostation is ARM, where chars are unsigned: it orders names byte by
+// byte as unsigned, the way the menu's file_manager_strcmp() does. The
+// simulator's strcmp() is the console's signed one (sim_libc.c).
+static int firmware_strcmp(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+	{
+		a++;
+		b++;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int collate_compare(const void *a, const void *b)
+{
+	const simEntry *ea = &entries[*(const uint32_t *)a];
+	const simEntry *eb = &entries[*(const uint32_t *)b];
+
+	if (ea->isDir != eb->isDir)
+	{
+		return ea->isDir ? -1 : 1;
+	}
+	return firmware_strcmp(ea->name, eb->name);
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+	size_t length = strlen(name);
+	size_t suffixLength = strlen(suffix);
+	return length >= suffixLength && !strcmp(name + length - suffixLength, suffix);
+}
+
+static int name_compare(const void *a, const void *b)
+{
+	return firmware_strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Flags every .bin whose .cue sits in the same folder.
+static void find_pairs(void)
+{
+	const char **names = malloc(sizeof(char *) * (entryCount + 1));
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		names[i] = entries[i].name;
+	}
+	qsort(names, entryCount, sizeof(char *), name_compare);
+
+	pairedBin = calloc(entryCount + 1, 1);
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if (entries[i].isDir || !has_suffix(entries[i].name, ".bin"))
+		{
+			continue;
+		}
+
+		char cue[SIM_MAX_NAME + 1];
+		snprintf(cue, sizeof(cue), "%s", entries[i].name);
+		memcpy(&cue[strlen(cue) - 4], ".cue", 4);
+
+		const char *key = cue;
+		pairedBin[i] = bsearch(&key, names, entryCount, sizeof(char *), name_compare) != NULL;
+	}
+	free(names);
+}
+
+static void build_order(void)
+{
+	find_pairs();
+
+	order = malloc(sizeof(uint32_t) * (entryCount + 1));
+	orderCount = 0;
+
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if ((config.collate && pairedBin[i]) || entries[i].removedGeneration)
+		{
+			continue;
+		}
+		order[orderCount++] = i;
+	}
+
+	if (config.collate)
+	{
+		qsort(order, orderCount, sizeof(uint32_t), collate_compare);
+	}
+}
+
+static void enter_folder(void)
+{
+	// A freshly read directory table can't be compared with older ones.
+	folderGeneration = ++generation;
+	load_directory();
+	build_order();
+	answerFirst = 0;
+	answerPages = 1;
+}
+
+// Entry `id` as the menu addresses it: its directory table position.
+static const simEntry *entry_by_id(uint32_t id)
+{
+	if (id >= entryCount || entries[id].removedGeneration)
+	{
+		return NULL;
+	}
+	return &entries[id];
+}
+
+// IO_COMMAND_GOTO_PATH: walk down from the root while the components exist.
+static void goto_path(const char *path)
+{
+	inResults = false;
+	while (depth > 0)
+	{
+		free(pathStack[--depth]);
+	}
+
+	while (*path && depth < SIM_MAX_DEPTH)
+	{
+		const char *end = strchr(path, '/');
+		size_t length = end ? (size_t)(end - path) : strlen(path);
+
+		load_directory();
+		uint32_t i = 0;
+		while (i < entryCount && !(entries[i].isDir && strlen(entries[i].name) == length && !strncmp(entries[i].name, path, length)))
+		{
+			i++;
+		}
+		if (i == entryCount)
+		{
+			break;
+		}
+		pathStack[depth++] = strdup(entries[i].name);
+
+		path += length;
+		if (*path == '/')
+		{
+			path++;
+		}
+	}
+	enter_folder();
+}
+
+static void finish_io_command(void)
+{
+	ioText[ioLength] = 0;
+	if (ioCommand == IO_COMMAND_SEARCH)
+	{
+		snprintf(searchQuery, sizeof(searchQuery), "%s", ioText);
+		inResults = true;
+		enter_folder();
+	}
+	else if (ioCommand == IO_COMMAND_GOTO_PATH)
+	{
+		goto_path(ioText);
+	}
+	ioCommand = IO_COMMAND_NONE;
+}
+
+void sim_firmware_init(const simFirmwareConfig *newConfig)
+{
+	config = *newConfig;
+	depth = 0;
+	inResults = false;
+	ioCommand = IO_COMMAND_NONE;
+	mountedName[0] = 0;
+	enter_folder();
+}
+
+void sim_firmware_command(uint8_t command, uint16_t argument)
+{
+	const simEntry *entry = entry_by_id(argument);
+
+	answerChanges = false;
+	answerMetadata = false;
+	responseLength = 0;
+	switch (command)
+	{
+	case COMMAND_GOTO_ROOT:
+		inResults = false;
+		while (depth > 0)
+		{
+			free(pathStack[--depth]);
+		}
+		enter_folder();
+		break;
+
+	case COMMAND_GOTO_PARENT:
+		// Leaving the results goes back to the folder searched from.
+		if (inResults)
+		{
+			inResults = false;
+		}
+		else if (depth > 0)
+		{
+			free(pathStack[--depth]);
+		}
+		enter_folder();
+		break;
+
+	case COMMAND_GOTO_DIRECTORY:
+		if (entry && entry->isDir && depth < SIM_MAX_DEPTH)
+		{
+			pathStack[depth++] = strdup(entry->name);
+		}
+		enter_folder();
+		break;
+
+	case COMMAND_GET_NEXT_CONTENTS:
+		answerFirst = argument;
+		answerPages = 1;
+		break;
+
+	case COMMAND_GET_CONTENTS_BATCH:
+		answerFirst = argument & 0xFFF;
+		answerPages = (argument >> 12) + 1;
+		break;
+
+	case COMMAND_MOUNT_FILE:
+		if (entry)
+		{
+			snprintf(mountedName, sizeof(mountedName), "%s", entry->name);
+		}
+		break;
+
+	case COMMAND_GET_CHANGES:
+		answerChanges = true;
+		answerSince = argument;
+		break;
+
+	case COMMAND_GET_CAPABILITIES:
+		// v1-only firmware stands for the firmware from before the handshake,
+		// which leaves the command unanswered.
+		if (config.collate)
+		{
+			// Only send what the menu said it can parse.
+			config.collate = argument & MENU_ACCEPTS_V2;
+			config.compress = config.collate && config.compress && (argument & MENU_ACCEPTS_COMPRESSED);
+			config.total = config.collate && config.total && (argument & MENU_ACCEPTS_TOTAL);
+			free(pairedBin);
+			free(order);
+			build_order();
+
+			uint16_t capabilities = FIRMWARE_CAP_BATCH | FIRMWARE_CAP_V2 | FIRMWARE_CAP_COMPRESSED |
+				FIRMWARE_CAP_CHANGES | FIRMWARE_CAP_SEARCH | FIRMWARE_CAP_GOTO_PATH | FIRMWARE_CAP_METADATA |
+				FIRMWARE_CAP_MOUNT_INFO;
+			response[0] = CAPABILITIES_MAGIC0;
+			response[1] = CAPABILITIES_MAGIC1;
+			response[2] = capabilities & 0xFF;
+			response[3] = capabilities >> 8;
+			response[4] = 8;
+			responseLength = sizeof(response);
+		}
+		break;
+
+	case COMMAND_IO_COMMAND:
+		ioCommand = argument;
+		ioLength = 0;
+		metadataCount = 0;
+		break;
+
+	case COMMAND_IO_DATA:
+		if (ioCommand == IO_COMMAND_METADATA)
+		{
+			if (argument == 0xFFFF)
+			{
+				answerMetadata = true;
+				ioCommand = IO_COMMAND_NONE;
+			}
+			else if (metadataCount < LISTING_METADATA_MAX)
+			{
+				metadataIds[metadataCount++] = argument;
+			}
+		}
+		else if (ioCommand == IO_COMMAND_SEARCH || ioCommand == IO_COMMAND_GOTO_PATH)
+		{
+			char pair[2] = {(char)(argument >> 8), (char)argument};
+			for (int i = 0; i < 2 && ioCommand != IO_COMMAND_NONE; i++)
+			{
+				if (pair[i] == 0 || ioLength == sizeof(ioText) - 1)
+				{
+					finish_io_command();
+				}
+				else
+				{
+					ioText[ioLength++] = pair[i];
+				}
+			}
+		}
+		break;
+	}
+}
+
+// Front-codes entries [first, first + count) against the previous name on the
+// page. Returns the encoded size, or 0 if it would not fit in `capacity`.
+static uint32_t front_code(uint32_t first, uint32_t count, uint8_t *out, uint32_t capacity)
+{
+	uint32_t size = 0;
+	const char *previous = "";
+	for (uint32_t index = first; index < first + count; index++)
+	{
+		const simEntry *entry = entry_at(index);
+		uint32_t prefix = 0;
+		while (prefix < 255 && previous[prefix] && previous[prefix] == entry->name[prefix])
+		{
+			prefix++;
+		}
+		uint32_t suffix = strlen(entry->name) - prefix;
+		if (size + LISTING_COMPRESSED_RECORD_HEADER + suffix > capacity)
+		{
+			return 0;
+		}
+
+		out[size] = (uint8_t)prefix;
+		out[size + 1] = (uint8_t)suffix;
+		out[size + 2] = entry->isDir ? LISTING_RECORD_DIRECTORY : 0;
+		out[size + 3] = order[index] & 0xFF;
+		out[size + 4] = (order[index] >> 8) & 0xFF;
+		memcpy(&out[size + LISTING_COMPRESSED_RECORD_HEADER], &entry->name[prefix], suffix);
+		size += LISTING_COMPRESSED_RECORD_HEADER + suffix;
+		previous = entry->name;
+	}
+	return size;
+}
+
+#define LZ_WINDOW 4096
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18
+#define LZ_HASH_SIZE 4096
+#define LZ_MAX_CHAIN 64
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (LZ_HASH_SIZE - 1);
+}
+
+// Greedy LZSS in the format listing_decompress() reads. Returns the packed
+// size, or 0 if it would not fit in `capacity`.
+static uint32_t lz_compress(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t capacity)
+{
+	static int32_t head[LZ_HASH_SIZE];
+	static int32_t prev[LISTING_DECODED_SIZE];
+	for (uint32_t i = 0; i < LZ_HASH_SIZE; i++)
+	{
+		head[i] = -1;
+	}
+
+	uint32_t outSize = 0;
+	uint32_t controlAt = 0;
+	uint32_t bit = 8;
+	uint32_t pos = 0;
+	while (pos < size)
+	{
+		if (bit == 8)
+		{
+			if (outSize + 1 > capacity)
+			{
+				return 0;
+			}
+			controlAt = outSize++;
+			out[controlAt] = 0;
+			bit = 0;
+		}
+
+		uint32_t bestLength = 0;
+		uint32_t bestDistance = 0;
+		if (pos + LZ_MIN_MATCH <= size)
+		{
+			int32_t candidate = head[lz_hash(&in[pos])];
+			for (uint32_t chain = 0; candidate >= 0 && pos - candidate <= LZ_WINDOW && chain < LZ_MAX_CHAIN; chain++)
+			{
+				uint32_t length = 0;
+				while (length < LZ_MAX_MATCH && pos + length < size && in[candidate + length] == in[pos + length])
+				{
+					length++;
+				}
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestDistance = pos - candidate;
+				}
+				candidate = prev[candidate];
+			}
+		}
+
+		uint32_t advance = 1;
+		if (bestLength >= LZ_MIN_MATCH)
+		{
+			if (outSize + 2 > capacity)
+			{
+				return 0;
+			}
+			out[controlAt] |= 1 << bit;
+			out[outSize] = (bestDistance - 1) & 0xFF;
+			out[outSize + 1] = (((bestDistance - 1) >> 8) << 4) | (bestLength - LZ_MIN_MATCH);
+			outSize += 2;
+			advance = bestLength;
+		}
+		else
+		{
+			if (outSize + 1 > capacity)
+			{
+				return 0;
+			}
+			out[outSize++] = in[pos];
+		}
+		bit++;
+
+		for (uint32_t i = 0; i < advance; i++, pos++)
+		{
+			if (pos + LZ_MIN_MATCH <= size)
+			{
+				uint32_t hash = lz_hash(&in[pos]);
+				prev[pos] = head[hash];
+				head[hash] = pos;
+			}
+		}
+	}
+	return outSize;
+}
+
+static uint8_t coded[LISTING_DECODED_SIZE];
+static uint8_t packed[LISTING_SIZE];
+
+// Records stop short of the folder size at the end of the page.
+#define PAYLOAD_END (config.total ? LISTING_SIZE - LISTING_TOTAL_SIZE : LISTING_SIZE)
+#define COMPRESSED_CAPACITY (PAYLOAD_END - LISTING_V2_HEADER_SIZE - LISTING_COMPRESSED_HEADER_SIZE)
+
+// Encodes `count` entries from `first` into coded/packed. Returns the packed
+// size, or 0 if they don't fit on a page.
+static uint32_t pack_entries(uint32_t first, uint32_t count, uint32_t *codedSize)
+{
+	*codedSize = front_code(first, count, coded, LISTING_DECODED_SIZE);
+	if (!*codedSize)
+	{
+		return 0;
+	}
+	return lz_compress(coded, *codedSize, packed, COMPRESSED_CAPACITY);
+}
+
+// Packs as many entries from `first` as fit into a compressed v2 payload and
+// returns the entry after the last one.
+static uint32_t build_compressed_payload(uint32_t first, uint8_t *payload)
+{
+	static uint8_t check[LISTING_DECODED_SIZE];
+
+	// Largest count that still fits, by doubling then bisecting.
+	uint32_t available = orderCount - first;
+	uint32_t codedSize;
+	uint32_t good = 0;
+	uint32_t bad = available + 1;
+	for (uint32_t count = 1; count <= available; count *= 2)
+	{
+		if (!pack_entries(first, count, &codedSize))
+		{
+			bad = count;
+			break;
+		}
+		good = count;
+	}
+	while (bad - good > 1)
+	{
+		uint32_t count = (good + bad) / 2;
+		if (pack_entries(first, count, &codedSize))
+		{
+			good = count;
+		}
+		else
+		{
+			bad = count;
+		}
+	}
+
+	uint32_t packedSize = pack_entries(first, good, &codedSize);
+	if (listing_decompress(packed, packedSize, check, codedSize) != codedSize || memcmp(check, coded, codedSize))
+	{
+		fprintf(stderr, "sim_firmware: compressed page does not round-trip\n");
+		abort();
+	}
+
+	payload[0] = good & 0xFF;
+	payload[1] = (good >> 8) & 0xFF;
+	payload[2] = codedSize & 0xFF;
+	payload[3] = (codedSize >> 8) & 0xFF;
+	memcpy(&payload[LISTING_COMPRESSED_HEADER_SIZE], packed, packedSize);
+	return first + good;
+}
+
+// Lays out one page starting at entry `first` and returns the entry after the
+// last one that fit.
+static uint32_t build_page(uint32_t first, uint8_t *page)
+{
+	memset(page, 0, LISTING_SIZE);
+
+	uint32_t offset = 0;
+	uint32_t recordHeader = 2;
+	if (config.collate)
+	{
+		page[0] = LISTING_V2_MAGIC0;
+		page[1] = LISTING_V2_MAGIC1;
+		page[2] = LISTING_V2_VERSION;
+		offset = LISTING_V2_HEADER_SIZE;
+		recordHeader = LISTING_V2_RECORD_HEADER;
+	}
+
+	uint32_t index = first;
+	if (config.compress)
+	{
+		index = build_compressed_payload(first, &page[offset]);
+	}
+	for (; index < orderCount && !config.compress; index++)
+	{
+		const simEntry *entry = entry_at(index);
+		uint32_t length = strlen(entry->name);
+		if (offset + recordHeader + length + SIM_TERMINATOR_SIZE > PAYLOAD_END)
+		{
+			break;
+		}
+
+		page[offset] = (uint8_t)length;
+		if (config.collate)
+		{
+			page[offset + 1] = entry->isDir ? LISTING_RECORD_DIRECTORY : 0;
+			page[offset + 2] = order[index] & 0xFF;
+			page[offset + 3] = (order[index] >> 8) & 0xFF;
+		}
+		else
+		{
+			page[offset + 1] = entry->isDir;
+		}
+		memcpy(&page[offset + recordHeader], entry->name, length);
+		offset += recordHeader + length;
+	}
+
+	bool last = index >= orderCount;
+	if (config.collate)
+	{
+		page[3] = LISTING_PAGE_CHECKED | (last ? LISTING_PAGE_LAST : 0) | (config.compress ? LISTING_PAGE_COMPRESSED : 0) |
+			(config.total ? LISTING_PAGE_TOTAL : 0);
+		page[4] = first & 0xFF;
+		page[5] = (first >> 8) & 0xFF;
+		page[8] = generation & 0xFF;
+		page[9] = generation >> 8;
+		if (config.total)
+		{
+			uint16_t total = orderCount < 0xFFFF ? orderCount : 0xFFFF;
+			page[LISTING_SIZE - 2] = total & 0xFF;
+			page[LISTING_SIZE - 1] = total >> 8;
+		}
+
+		uint16_t checksum = listing_checksum((const char *)page);
+		page[6] = checksum & 0xFF;
+		page[7] = checksum >> 8;
+	}
+	else
+	{
+		page[offset + 1] = last ? 0 : 1;
+		page[offset + 2] = last ? 0xFF : 0;
+		page[offset + 3] = last ? 0xFF : 0;
+	}
+
+	return index;
+}
+
+// Lays out the answer to COMMAND_GET_CHANGES: every entry added or removed
+// after `answerSince`, or a reset if that predates the directory table.
+static void build_changes_page(uint8_t *page)
+{
+	memset(page, 0, LISTING_SIZE);
+	page[0] = LISTING_V2_MAGIC0;
+	page[1] = LISTING_CHANGES_MAGIC1;
+	page[2] = LISTING_V2_VERSION;
+	page[3] = LISTING_PAGE_CHECKED | LISTING_PAGE_LAST;
+	page[4] = answerSince & 0xFF;
+	page[5] = answerSince >> 8;
+	page[8] = generation & 0xFF;
+	page[9] = generation >> 8;
+
+	bool reset = answerSince < folderGeneration || answerSince > generation;
+	uint32_t offset = LISTING_V2_HEADER_SIZE;
+	for (uint32_t id = 0; id < entryCount && !reset; id++)
+	{
+		const simEntry *entry = &entries[id];
+		bool added = entry->addedGeneration > answerSince && !entry->removedGeneration;
+		bool removed = entry->removedGeneration > answerSince && entry->addedGeneration <= answerSince;
+		if ((!added && !removed) || (config.collate && pairedBin[id]))
+		{
+			continue;
+		}
+
+		uint32_t length = strlen(entry->name);
+		if (offset + LISTING_V2_RECORD_HEADER + length + 1 > LISTING_SIZE)
+		{
+			reset = true;
+			break;
+		}
+		page[offset] = (uint8_t)length;
+		page[offset + 1] = (entry->isDir ? LISTING_RECORD_DIRECTORY : 0) | (removed ? LISTING_RECORD_REMOVED : 0);
+		page[offset + 2] = id & 0xFF;
+		page[offset + 3] = (id >> 8) & 0xFF;
+		memcpy(&page[offset + LISTING_V2_RECORD_HEADER], entry->name, length);
+		offset += LISTING_V2_RECORD_HEADER + length;
+	}
+
+	if (reset)
+	{
+		memset(&page[LISTING_V2_HEADER_SIZE], 0, LISTING_SIZE - LISTING_V2_HEADER_SIZE);
+		page[3] |= LISTING_CHANGES_RESET;
+	}
+
+	uint16_t checksum = listing_checksum((const char *)page);
+	page[6] = checksum & 0xFF;
+	page[7] = checksum >> 8;
+}
+
+
+// Size and track count of a real image. A cue sheet's tracks are counted from
+// its TRACK lines and its size is that of the .bin next to it.
+static void stat_image(const simEntry *entry, uint32_t *size, uint8_t *tracks)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s", config.rootPath);
+	for (int i = 0; i < depth && !inResults; i++)
+	{
+		strncat(path, "/", sizeof(path) - strlen(path) - 1);
+		strncat(path, pathStack[i], sizeof(path) - strlen(path) - 1);
+	}
+	strncat(path, "/", sizeof(path) - strlen(path) - 1);
+	strncat(path, entry->name, sizeof(path) - strlen(path) - 1);
+
+	*tracks = 1;
+	if (has_suffix(path, ".cue"))
+	{
+		FILE *cue = fopen(path, "r");
+		char line[512];
+		*tracks = 0;
+		while (cue && fgets(line, sizeof(line), cue))
+		{
+			*tracks += strstr(line, "TRACK ") != NULL;
+		}
+		if (cue)
+		{
+			fclose(cue);
+		}
+		strcpy(&path[strlen(path) - 4], ".bin");
+	}
+
+	struct stat st;
+	*size = stat(path, &st) == 0 ? (uint32_t)st.st_size : 0;
+}
+
+// Lays out the answer to IO_COMMAND_METADATA. Synthetic images get details
+// made up from their index; folders and unknown indices are left out.
+static void build_metadata_page(uint8_t *page)
+{
+	memset(page, 0, LISTING_SIZE);
+	page[0] = LISTING_V2_MAGIC0;
+	page[1] = LISTING_METADATA_MAGIC1;
+	page[2] = LISTING_V2_VERSION;
+	page[3] = LISTING_PAGE_CHECKED | LISTING_PAGE_LAST;
+
+	uint32_t records = 0;
+	for (uint32_t i = 0; i < metadataCount; i++)
+	{
+		uint16_t id = metadataIds[i];
+		const simEntry *entry = entry_by_id(id);
+		if (!entry || entry->isDir)
+		{
+			continue;
+		}
+
+		uint32_t size = 300u * 1024 * 1024 + (id * 7919u) % (400u * 1024 * 1024);
+		uint8_t tracks = 1 + id % 3;
+		uint8_t *record = &page[LISTING_V2_HEADER_SIZE + records * LISTING_METADATA_RECORD_SIZE];
+		record[0] = id & 0xFF;
+		record[1] = id >> 8;
+		record[2] = LISTING_METADATA_PS1;
+		if (config.rootPath)
+		{
+			stat_image(entry, &size, &tracks);
+		}
+		else
+		{
+			record[3] = "JUE"[id % 3];
+			snprintf((char *)&record[12], LISTING_METADATA_GAME_ID_SIZE, "SLUS_%03u.%02u", id % 1000, id % 100);
+		}
+		record[4] = tracks;
+		record[8] = size & 0xFF;
+		record[9] = (size >> 8) & 0xFF;
+		record[10] = (size >> 16) & 0xFF;
+		record[11] = size >> 24;
+		records++;
+	}
+	page[4] = records & 0xFF;
+	page[5] = records >> 8;
+
+	uint16_t checksum = listing_checksum((const char *)page);
+	page[6] = checksum & 0xFF;
+	page[7] = checksum >> 8;
+}
+
+void sim_firmware_change(uint32_t adds, uint32_t removes)
+{
+	generation++;
+
+	for (uint32_t i = 0; i < entryCount && removes > 0; i++)
+	{
+		if (entries[i].isDir && !entries[i].removedGeneration)
+		{
+			entries[i].removedGeneration = generation;
+			removes--;
+		}
+	}
+
+	for (uint32_t i = 0; i < adds; i++)
+	{
+		char name[SIM_MAX_NAME + 1];
+		snprintf(name, sizeof(name), "Added %u-%u.chd", generation, i);
+		add_entry(name, 0);
+		entries[entryCount - 1].addedGeneration = generation;
+	}
+
+	free(pairedBin);
+	free(order);
+	build_order();
+}
+
+void sim_firmware_read_sector(uint32_t index, uint8_t *sector)
+{
+	memset(sector, 0, LISTING_SECTOR_SIZE);
+
+	uint8_t *page = &sector[LISTING_HEADER_SIZE];
+	if (answerChanges)
+	{
+		if (index == 0)
+		{
+			build_changes_page(page);
+		}
+		return;
+	}
+	if (answerMetadata)
+	{
+		if (index == 0)
+		{
+			build_metadata_page(page);
+			if (config.corruptEvery && ++sectorsServed % config.corruptEvery == 0)
+			{
+				page[LISTING_V2_HEADER_SIZE + 4] ^= 0x20;
+			}
+		}
+		return;
+	}
+
+	uint32_t first = answerFirst;
+	for (uint32_t i = 0; i <= index; i++)
+	{
+		if (i >= answerPages || first > orderCount)
+		{
+			return;
+		}
+		first = build_page(first, page);
+	}
+
+	// Flip bits the way a marginal read would: in the payload for v2, where
+	// the checksum catches it, or in the first flag byte for v1.
+	if (config.corruptEvery && ++sectorsServed % config.corruptEvery == 0)
+	{
+		if (config.collate)
+		{
+			page[LISTING_V2_HEADER_SIZE + 4] ^= 0x20;
+		}
+		else
+		{
+			page[1] ^= 0x80;
+		}
+	}
+}
+
+uint8_t sim_firmware_response(uint8_t *out)
+{
+	memcpy(out, response, responseLength);
+	return responseLength;
+}
+
+uint32_t sim_firmware_visible_count(void)
+{
+	if (config.collate)
+	{
+		return orderCount;
+	}
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		if (!pairedBin[i])
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+const char *sim_firmware_name_at(uint32_t index)
+{
+	return index < orderCount ? entry_at(index)->name : NULL;
+}
+
+const char *sim_firmware_mounted(void)
+{
+	return mountedName;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host-side stand-in for the listing half of the picostation firmware. It
+// answers the same COMMAND_* requests the menu sends through CDROM_CMD_TEST
+// and lays out the answer exactly as the firmware does at LBA 100.
+//
+// Entries are identified by their position in the folder's directory table,
+// which stays put when entries are added or removed, so the firmware index in
+// v2 records and COMMAND_GET_CHANGES answers is that position.
+
+typedef struct
+{
+	char *name;
+	uint8_t isDir;
+	uint16_t addedGeneration;   // Generation the entry appeared in
+	uint16_t removedGeneration; // Generation it went away in, 0 if present
+} simEntry;
+
+typedef struct
+{
+	bool collate;           // Answer with pre-sorted v2 pages; without, act as firmware from before the handshake
+	bool compress;          // Front-code and LZSS pack v2 pages
+	bool total;             // End v2 pages with the folder's entry count
+	const char *rootPath;   // Real directory tree, or NULL for a synthetic folder
+	uint32_t syntheticCount;
+	uint32_t corruptEvery;  // Damage every Nth sector served, 0 for never
+} simFirmwareConfig;
+
+void sim_firmware_init(const simFirmwareConfig *config);
+void sim_firmware_command(uint8_t command, uint16_t argument);
+
+/// @brief Copy the response bytes the last command returns after the drive
+/// status. Only COMMAND_GET_CAPABILITIES has any.
+/// @return Number of bytes copied.
+uint8_t sim_firmware_response(uint8_t *response);
+
+/// @brief Copy listing sector `index` of the last answer into a 2340-byte buffer.
+void sim_firmware_read_sector(uint32_t index, uint8_t *sector);
+
+/// @brief Number of entries the menu should end up with in the current folder.
+uint32_t sim_firmware_visible_count(void);
+
+const char *sim_firmware_mounted(void);
+
+/// @brief Name of the entry shown at `index` of a collated listing.
+const char *sim_firmware_name_at(uint32_t index);
+
+/// @brief Add `adds` new images to the current folder and remove `removes`
+/// folders from it, as if the card had been edited, and bump its generation.
+void sim_firmware_change(uint32_t adds, uint32_t removes);
@@ -0,0 +1,34 @@
+// The console's string comparisons, from ps1-bare-metal/libc/string.c, so the
+// menu code compares names on the host the way it does on the PS1: chars are
+// signed there (-fsigned-char), and so is what strcmp() orders them by. These
+// take the place of the host libc's for the whole simulator; the menu sources
+// are built with -fno-builtin for them so the compiler doesn't fold calls
+// with its own.
+
+#include <stddef.h>
+
+int strcmp(const char *lhs, const char *rhs)
+{
+	for (;;)
+	{
+		char a = *(lhs++), b = *(rhs++);
+
+		if (a != b)
+			return a - b;
+		if (!a && !b)
+			return 0;
+	}
+}
+
+int strncmp(const char *lhs, const char *rhs, size_t count)
+{
+	for (; count && *lhs && *rhs; count--)
+	{
+		char a = *(lhs++), b = *(rhs++);
+
+		if (a != b)
+			return a - b;
+	}
+
+	return 0;
+}